@@ -56,4 +56,21 @@ extern output_opts_t output_opts;
 void output_stats (tabbuf_t &b, const str &h,
                    const dsdc_get_stats_single_res_t &res);
 
+// per-slave stats and the master's merge of them, with quantiles
+void output_stats2 (tabbuf_t &b, const dsdc_get_stats2_res_t &res);
+
+void output_rpc_stats (tabbuf_t &b, const str &h, const dsdc_rpc_stats_t &s);
+
+// a slave's miss ratio curve, at multiples of its cache size, as a
+// whole and by annotation
+void output_mrc (tabbuf_t &b, const str &h, const dsdc_slave_mrc_t &m);
+
+// a slave's hot keys, from its last complete window
+void output_hot_keys (tabbuf_t &b, const str &h, const dsdc_hot_keys_t &k);
+
+// read trace logs, and draw the traces in them (all of them, or just
+// one if trace is nonzero) that took at least min_usec
+int output_traces (tabbuf_t &b, const vec<str> &files, u_int64_t trace,
+                   u_int64_t min_usec);
+
 #endif /* _DSDC_ADMIN_H_ */
@@ -8,9 +8,15 @@
 #include "dsdc_util.h"  // elements common to master and slave
 #include "dsdc_const.h" // constants
 #include "dsdc_ring.h"  // the consistent hash ring
+#include "dsdc_raw.h"   // raw passthrough forwarding
+#include "dsdc_rpcstats.h" // per-procedure RPC stats
+#include "dsdc_stats.h"    // merging slave stats
+#include "dsdc_metrics.h"  // the metrics page
+#include "dsdc_trace.h"    // sampled request tracing
 
 #include "itree.h"
 #include "ihash.h"
+#include "qhash.h"
 #include "async.h"
 #include "arpc.h"
 #include "tame.h"
@@ -46,11 +52,16 @@ public:
 
     void unregister_slave () { _slave = NULL; }
 
+    // for pushing DSDC_STATE_CHANGED back down this connection
+    void push_state_changed (const dsdc_state_changed_arg_t &a);
+    list_entry<dsdcm_client_t> _sublnk;
+
 protected:
     dsdcm_client_t (dsdc_master_t *m, int _fd, const str &h);
     void init ();
     void handle_heartbeat (svccb *b);
     void handle_register (svccb *b);
+    void handle_subscribe (svccb *b);
 
     // if this client has registered as a slave, then this pointer field
     // will be set.  we set up bidirectional pointers here.
@@ -61,6 +72,7 @@ protected:
     ptr<axprt> _x;          // a wrapper around the fd for the client
     ptr<asrv> _asrv;        // async RPC server
     str _hostname;          // hostname / port of client
+    ptr<aclnt> _push_cli;   // non-NULL if subscribed to state changes
 };
 
 /**
@@ -74,8 +86,11 @@ public:
     dsdcm_slave_base_t (ptr<dsdcm_client_t> c, ptr<axprt> x);
     virtual ~dsdcm_slave_base_t () {}
     void release ();
-    void init (const dsdcx_slave_t &keys);
+    void init (const dsdcx_slave_t &keys, const str &group = NULL);
     void get_xdr_repr (dsdcx_slave_t *o) { *o = _xdr_repr; }
+    const dsdcx_slave_t &xdr_repr () const { return _xdr_repr; }
+    const str &group () const { return _group; }
+    const dsdc_key_t &xdr_hash () const { return _xdr_hash; }
     const str &remote_peer_id () const { return _client->remote_peer_id (); }
     ptr<aclnt> get_aclnt () { return _clnt_to_slave; }
     void handle_heartbeat () { _last_heartbeat = sfs_get_timenow (); }
@@ -87,9 +102,8 @@ public:
     /**
      * insert all of this slave's node into the master hash ring.
      * data servers obviously need nodes so that data can be
-     * routed toward them.  for now, locking is going to be centralized,
-     * so there is no need for lock servers to have node; their insert
-     * operations will be noops..
+     * routed toward them.  lock servers put their nodes into a
+     * separate ring, over which locks are partitioned by key.
      */
     void insert_nodes ();
     virtual void insert_node (dsdc_master_t *m, dsdc_ring_node_t *n) = 0;
@@ -105,7 +119,11 @@ public:
 
 
 protected:
+    virtual void post_init () {}
+
     dsdcx_slave_t _xdr_repr;           // XDR representation of us
+    str _group;                        // our slave group; NULL if default
+    dsdc_key_t _xdr_hash;              // SHA1 of the above, and _group
     ptr<dsdcm_client_t> _client;       // associated client object
     ptr<aclnt> _clnt_to_slave;         // RPC client for talking to slave
     vec<dsdc_ring_node_t *> _nodes;    // this slave's nodes in the ring
@@ -125,6 +143,8 @@ public:
     ihash_entry<dsdcm_slave_t> _hlnk;
 protected:
     dsdcm_slave_t (ptr<dsdcm_client_t> c, ptr<axprt> x);
+    void post_init ();
+    bool _hashed;      // folded into the master's state hash
 };
 
 template<> struct keyfn<dsdcm_slave_t, str>
@@ -146,6 +166,48 @@ public:
     tailq_entry<dsdcm_lock_server_t> _lnk;
 protected:
     dsdcm_lock_server_t (ptr<dsdcm_client_t> c, ptr<axprt> x);
+    void post_init ();
+    bool _hashed;      // folded into the master's lock server hash
+};
+
+/**
+ * the change to the system state that took the master from epoch
+ * _epoch - 1 to _epoch.  The master keeps a bounded history of these
+ * so that smart clients can catch up with DSDC_GETSTATE2 without
+ * shipping the whole ring.
+ */
+struct dsdcm_epoch_t {
+    dsdcm_epoch_t (u_int64_t e) : _epoch (e) {}
+    u_int64_t _epoch;
+    dsdcx_state_delta_t _delta;
+};
+
+/**
+ * the slaves that came and went since the last epoch was closed.
+ * Adds are keyed by host:port, but remember which registration made
+ * them, since the old instance of a slave that re-registered can be
+ * torn down after the new one is in.
+ */
+class dsdcm_epoch_journal_t {
+public:
+    void add (const str &id, const dsdcx_slave_t &x, const str &group,
+              const dsdcm_slave_t *owner);
+    // only if owner's add is the one pending for id
+    void cancel_add (const str &id, const dsdcm_slave_t *owner);
+    void remove (const str &h, int p);
+    void clear ();
+    void to_delta (dsdcx_state_delta_t *out) const;
+
+    // who's published for each id, once these changes go out
+    void publish (qhash<str, const dsdcm_slave_t *> *p) const;
+    size_t size () const { return _added.size () + _removed.size (); }
+private:
+    vec<dsdcx_slave_t> _added;
+    vec<str> _added_group;                 // NULL for the default group
+    vec<const dsdcm_slave_t *> _added_owner;
+    qhash<str, size_t> _added_ix;
+    vec<dsdcx_slave_id_t> _removed;
+    bhash<str> _removed_ix;
 };
 
 //
@@ -157,7 +219,10 @@ protected:
 class dsdc_master_t : public dsdc_app_t {
 public:
     dsdc_master_t (int p = -1) :
-            _port (p > 0 ? p : dsdc_port), _lfd (-1), _n_slaves (0) {}
+            _port (p > 0 ? p : dsdc_port), _lfd (-1), _n_slaves (0),
+            _raw_forward (false),
+            _incarnation (0), _epoch (0), _pushed_epoch (0),
+            _push_scheduled (false) {}
     virtual ~dsdc_master_t () {}
 
     bool init ();                      // launch this master
@@ -173,26 +238,40 @@ public:
     void remove_client (dsdcm_client_t *cli)
     { _clients.remove (cli); }
 
+    void insert_subscriber (dsdcm_client_t *cli)
+    { _subscribers.insert_head (cli); }
+    void remove_subscriber (dsdcm_client_t *cli)
+    { _subscribers.remove (cli); }
+
     void insert_slave (dsdcm_slave_t *sl);
     void remove_slave (dsdcm_slave_t *sl);
 
     void insert_lock_server (dsdcm_lock_server_t *ls);
     void remove_lock_server (dsdcm_lock_server_t *ls);
-    void insert_lock_node (dsdc_ring_node_t *node) {}
-    void remove_lock_node (dsdc_ring_node_t *node) {}
+    void insert_lock_node (dsdc_ring_node_t *node)
+    { _lock_ring.insert (node); }
+    void remove_lock_node (dsdc_ring_node_t *node)
+    { _lock_ring.remove (node); }
 
     // given a key, look in the consistent hash ring for a corresponding
     // node, and then get the ptr<aclnt> that corresponds to the remote
-    // host
+    // host.  The master only routes for the default slave group; the
+    // others can only be reached by smart clients.
     dsdc_res_t get_aclnt (const dsdc_key_t &k, ptr<aclnt> *cli);
 
+    // same, but for the lock server that owns k
+    dsdc_res_t get_lock_aclnt (const dsdc_key_t &k, ptr<aclnt> *cli);
+
     void handle_get (svccb *b, CLOSURE);
     void handle_remove (svccb *b, CLOSURE);
     void handle_put (svccb *b, CLOSURE);
+    void handle_raw (svccb *b, CLOSURE);
     void handle_getstate (svccb *b);
+    void handle_getstate2 (svccb *b);
     void handle_lock_release (svccb *b);
     void handle_lock_acquire (svccb *b);
     void handle_get_stats (svccb *b, CLOSURE);
+    void handle_get_stats2 (svccb *b, CLOSURE);
 
     void broadcast_newnode (const dsdcx_slave_t &x, dsdcm_slave_t *skip,
                             CLOSURE);
@@ -200,8 +279,22 @@ public:
     // manage the system state
     void reset_system_state ();
     void compute_system_state ();
-
-    dsdcm_lock_server_t *lock_server () { return _lock_servers.first; }
+    const dsdcx_state_t &full_system_state ();
+    void hash_in_slave (dsdcm_slave_t *sl);
+    void hash_out_slave (dsdcm_slave_t *sl);
+    void hash_lock_server (dsdcm_lock_server_t *ls);
+    void get_lock_servers (rpc_vec<dsdcx_slave_t, RPC_INFINITY> *out) const;
+    void schedule_push ();
+    void push_state_changed ();
+
+    // the lock server that owns k; lock servers too old to register
+    // nodes leave the lock ring empty, in which case the first one
+    // takes all locks, as before.
+    aclnt_wrap_t *lock_server (const dsdc_key_t &k);
+
+    // forward GET/PUT/REMOVE without decoding them; see dsdc_raw.h
+    void set_raw_forward (bool b) { _raw_forward = b; }
+    bool raw_forward () const { return _raw_forward; }
 
     void watchdog_timer_loop (CLOSURE);
 
@@ -210,12 +303,23 @@ public:
         return strbuf ("master listening on %s:%d", dsdc_hostname.cstr (), _port);
     }
     str progname_xtra () const { return "_master"; }
+    void output_metrics (dsdc::metrics::out_t *o);
 
 protected:
     void check_all_slaves ();
+    void close_epoch ();
+    bool compute_delta (u_int64_t from, dsdcx_state_delta_t *out) const;
     void get_stats (dsdc_slave_statistic_t *out,
                     const dsdc_get_stats_single_arg_t *arg,
                     dsdcm_slave_t *sl, cbv cb, CLOSURE);
+    void get_stats2 (dsdc_slave_statistic2_t *out,
+                     const dsdc_get_stats_single_arg_t *arg,
+                     dsdcm_slave_t *sl, cbv cb, CLOSURE);
+
+    // the slaves a set picks out, along with their names; a NULL
+    // slave is one that was named but that we don't know of.
+    void select_slaves (const dsdc_slaveset_t &set,
+                        vec<dsdcm_slave_t *> *out, vec<str> *names);
 private:
 
     void broadcast_deletes (const dsdc_key_t &k, dsdcm_slave_t *skip);
@@ -231,6 +335,7 @@ private:
     list<dsdcm_slave_t, &dsdcm_slave_t::_lnk> _slaves;
     fhash<str, dsdcm_slave_t, &dsdcm_slave_t::_hlnk> _slave_hash;
     int _n_slaves;
+    bool _raw_forward;
 
     // the itree containing all of the nodes in the consistent hash ring
     // for all of the slaves.  note that every slave in the ring can
@@ -240,9 +345,33 @@ private:
 
     ptr<dsdcx_state_t> _system_state;       // system state in XDR format
     ptr<dsdc_key_t>    _system_state_hash;  // hash of the above
-
-    // only the first is active, the rest are backups.
+    dsdc_state_hasher_t _slaves_hasher;     // kept current slave by slave
+    ptr<dsdc_key_t>    _legacy_state_hash;  // for DSDC_GETSTATE
+
+    // full GETSTATE/GETSTATE2 replies, XDR-encoded once per state change
+    str _getstate_reply;
+    str _getstate2_reply;
+
+    // for DSDC_GETSTATE2; the incarnation changes with every master
+    // restart, and the epoch with every change to the system state.
+    u_int64_t _incarnation;
+    u_int64_t _epoch;
+    dsdcm_epoch_journal_t _pending;          // changes since _epoch
+    // slaves as of _epoch, and which instance of each; only compared,
+    // never followed, since the instance might be gone
+    qhash<str, const dsdcm_slave_t *> _published;
+    dsdc_state_hasher_t _lock_hasher;        // all lock servers
+    dsdc_key_t _published_lock_servers;      // ... as of _epoch
+    vec<ptr<dsdcm_epoch_t> > _history;       // deltas up to _epoch
+
+    // clients that asked for DSDC_STATE_CHANGED pushes
+    list<dsdcm_client_t, &dsdcm_client_t::_sublnk> _subscribers;
+    u_int64_t _pushed_epoch;                 // last epoch pushed out
+    bool _push_scheduled;                    // coalesce resets
+
+    // all lock servers, and the ring that their nodes make up
     tailq<dsdcm_lock_server_t, &dsdcm_lock_server_t::_lnk> _lock_servers;
+    dsdc_hash_ring_t _lock_ring;
 };
 
 #endif /* _DSDC_MASTER_H */
@@ -4,9 +4,13 @@
 #include "dsdc_util.h"
 #include "dsdc_const.h"
 #include "dsdc.h"
+#include "dsdc_raw.h"
+#include "dsdc_metrics.h"
+#include "dsdc_rpcstats.h"
 
 #include "itree.h"
 #include "ihash.h"
+#include "qhash.h"
 #include "async.h"
 #include "arpc.h"
 #include "tame.h"
@@ -14,6 +18,39 @@
 //-----------------------------------------------------------------------------
 
 class dsdc_proxy_t;
+struct dsdc_proxy_mget_batch_t;
+
+//-----------------------------------------------------------------------------
+
+//
+// Serves MGET, MGET2 and MGET3 for the proxy.  Keys are split up by
+// the slave that owns them, and keys from concurrent client requests
+// that are headed to the same slave (with the same flavor of MGET) are
+// held for up to dsdc_proxy_mget_window_us and sent as one MGET.
+// Replies are split back out to the clients they came from.
+//
+class dsdc_proxy_mget_t {
+public:
+    dsdc_proxy_mget_t(dsdc_proxy_t* p, ptr<dsdc_smartcli_t> c)
+        : m_proxy(p), m_cli(c), m_serial(0) {}
+    ~dsdc_proxy_mget_t();
+
+    void handle(svccb* sbp);
+
+    // for dsdc_proxy_mget_batch_t
+    void flush(str id, u_int64_t serial);
+    dsdc_proxy_t* proxy() { return m_proxy; }
+
+private:
+    dsdc_proxy_mget_batch_t* open_batch(u_int32_t proc, 
+                                        ptr<aclnt_wrap_t> w);
+    void send(dsdc_proxy_mget_batch_t* b);
+
+    dsdc_proxy_t* m_proxy;
+    ptr<dsdc_smartcli_t> m_cli;
+    qhash<str, dsdc_proxy_mget_batch_t*> m_open;  // by proc and slave
+    u_int64_t m_serial;
+};
 
 //-----------------------------------------------------------------------------
 
@@ -40,7 +77,8 @@ class dsdc_proxy_t : public dsdc_app_t {
 public:
 
     dsdc_proxy_t(int p = -1) :
-        m_port(p > 0 ? p : dsdc_proxy_port), m_lfd(-1) {
+        m_port(p > 0 ? p : dsdc_proxy_port), m_lfd(-1), m_raw(false),
+        m_n_workers(1), m_worker_id(-1), m_mget(NULL) {
         m_cli = New refcounted<dsdc_smartcli_t>();    
     }
 
@@ -50,16 +88,56 @@ public:
     void handle_get (svccb *b, CLOSURE);
     void handle_remove (svccb *b, CLOSURE);
     void handle_put (svccb *b, CLOSURE);
+    void handle_raw (svccb *b, CLOSURE);
 
     void add_master(const str& m, int port);
 
+    // forward GET/PUT/REMOVE without decoding them; see dsdc_raw.h
+    void set_raw_forward(bool b) { m_raw = b; }
+    bool raw_forward() const { return m_raw; }
+
+    // Run as n worker processes that share the listen socket, each with
+    // its own smart client and slave connections.  The async library
+    // has one event loop per process, so workers are processes rather
+    // than threads.
+    void set_n_workers(int n) { m_n_workers = n > 0 ? n : 1; }
+
+    str progname_xtra() const { return "_proxy"; }
+    void output_metrics(dsdc::metrics::out_t* o);
+
+    void handle_mget(svccb* sbp) { m_mget->handle(sbp); }
+
+    // record a finished call in rpc_stats and dsdc::rpcstats, or in
+    // our own counters if this is one of several workers
+    void end_call(svccb* sbp, const timespec& ts_start, bool err);
+
 protected:
 
+    bool init_worker();
+    void spawn_workers();
+    void spawn_worker(size_t i);
+    void worker_died(size_t i, int status);
+    void recv_stats(size_t i, const char* pkt, ssize_t len, const sockaddr*);
+    dsdc_proxy_proc_stats_t& proc_stats(u_int32_t proc);
+    void report_loop(CLOSURE);
+    void dump_loop(CLOSURE);
+
     int m_port;
     int m_lfd;
+    bool m_raw;
 
     ptr<dsdc_smartcli_t> m_cli;
+
+    // multi-process mode
+    int m_n_workers;
+    int m_worker_id;                 // -1 in the parent
+    vec<pid_t> m_worker_pids;        // parent only
+    vec<ptr<axprt> > m_worker_x;     // parent only; stats from workers
+    ptr<axprt> m_parent_x;           // worker only; stats to parent
+    vec<dsdc_proxy_proc_stats_t> m_stats;  // indexed by proc number
+    vec<dsdc::rpcstats::histogram_t> m_latency;  // worker only; ditto
+
+    dsdc_proxy_mget_t* m_mget;
 };
 
 //-----------------------------------------------------------------------------
-
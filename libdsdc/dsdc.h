@@ -22,6 +22,7 @@
 #include "dsdc_const.h"
 #include "dsdc_stats.h"
 #include "dsdc_format.h"
+#include "dsdc_trace.h"
 
 typedef dsdc::annotation::base_t annotation_t;
 
@@ -50,6 +51,11 @@ public:
      */
     virtual void eof_hook () {};
 
+    /**
+     * called after every successful (re)connect
+     */
+    virtual void connected_hook () {}
+
     /**
      * say if it's a master or slave connection (for logging)
      */
@@ -89,6 +95,7 @@ public:
 
 protected:
     void trigger_waiters();
+    ptr<axprt> xprt () { return _x; }
 
 public:
     const str _key;
@@ -121,12 +128,25 @@ public:
 //
 class dsdci_master_t : public dsdci_retry_srv_t {
 public:
-    dsdci_master_t (const str &h, int p) : dsdci_retry_srv_t (h,p) {}
+    dsdci_master_t (const str &h, int p, dsdc_system_state_cache_t *c)
+        : dsdci_retry_srv_t (h,p), _cache (c) {}
 
     str typ () const { return "master"; }
 
+    // serve DSDC_STATE_CHANGED pushes on the same connection, and
+    // subscribe to them.
+    void connected_hook ();
+    void eof_hook ();
+    void dispatch (svccb *sbp);
+
+    // the smart client is going away
+    void detach () { _cache = NULL; }
+
     tailq_entry<dsdci_master_t> _lnk;
     ihash_entry<dsdci_master_t> _hlnk;
+private:
+    dsdc_system_state_cache_t *_cache;
+    ptr<asrv> _srv;
 };
 
 //
@@ -169,6 +189,19 @@ typedef callback<void, ptr<dsdc_mget_res_t> >::ref dsdc_mget_res_cb_t;
 typedef callback<void, ptr<dsdc_lock_acquire_res_t> >::ref
 dsdc_lock_acquire_res_cb_t;
 
+// what lock_acquire_multi () hands back: a bundle ID per lock server
+// involved, and for each, the peer ID (host:port) of the lock server
+// that granted it, which is where it's released, even if the lock
+// ring has changed since.
+struct dsdc_lock_bundle_t {
+    vec<str> servers;
+    vec<dsdcl_id_t> ids;
+};
+typedef callback<void, dsdc_res_t, ptr<dsdc_lock_bundle_t> >::ref
+dsdc_lock_multi_cb_t;
+typedef callback<void, ptr<dsdc_lock_get_res_t> >::ref dsdc_lock_get_res_cb_t;
+typedef callback<void, ptr<dsdc_lease_get_res_t> >::ref dsdc_lease_get_res_cb_t;
+
 class dsdc_smartcli_t;
 
 
@@ -227,7 +260,9 @@ public:
     /**
      * @brief Acquire a lock from the DSDC lock server
      *
-     * Acquire a lock from the DSDC lock server.  The salient
+     * Acquire a lock from the DSDC lock server that owns k; locks are
+     * spread over all lock servers by key, like data is over slaves.
+     * The salient
      * options to this operation are what kind of lock to acquire
      * (either shared for reading or exclusive for reading) and
      * also whether or not to block while acquiring it.  In the
@@ -293,6 +328,58 @@ public:
     void lock_release (const K &k, dsdcl_id_t id, cbi::ptr cb = NULL,
                        bool safe = false);
 
+    /**
+     * @brief Get an object, or a lease to fill it in on a miss.
+     *
+     * Like get (), but on a miss only the first caller is asked to
+     * go regenerate the object.  That caller gets DSDC_NOTFOUND or
+     * DSDC_EXPIRED and a nonzero lease, and should hand the lease
+     * back to put_lease () along with the new value.  Meanwhile, other
+     * callers get DSDC_RETRY, with the old value if it had expired,
+     * or with NULL, in which case they should wait a bit and try again.
+     *
+     * @param k the key to get
+     * @param cb called back with a status, the object, and a lease
+     */
+    void get_lease (const K &k,
+                    typename callback<void, dsdc_res_t, ptr<V>,
+                                      dsdcl_id_t>::ref cb,
+                    const annotation_t *a = NULL);
+
+    /**
+     * @brief Get an object, serving it stale for a while once expired.
+     *
+     * Like get_lease (), but once the object is older than this
+     * interface's time_to_expire, it is kept around for another
+     * grace seconds, and comes back with DSDC_EXPIRED_STALE.  One
+     * caller also gets a nonzero lease, and should regenerate the
+     * object and put_lease () it, while everyone (that caller
+     * included) can go on using the stale value in the meantime.
+     *
+     * @param k the key to get
+     * @param cb called back with a status, the object, and a lease
+     * @param grace how many seconds past expiration to serve stale data
+     */
+    void get_stale (const K &k,
+                    typename callback<void, dsdc_res_t, ptr<V>,
+                                      dsdcl_id_t>::ref cb,
+                    u_int grace, const annotation_t *a = NULL);
+
+    /**
+     * @brief Fill in an object with a lease from get_lease ().
+     *
+     * Fails with DSDC_STALE_LEASE, and stores nothing, if the lease
+     * timed out or if someone else changed or removed the key since
+     * the lease was granted.
+     *
+     * @param k the key to file the object under
+     * @param obj the object to store
+     * @param lease the lease returned by get_lease ()
+     * @param cb get called back at cb with a status code
+     */
+    void put_lease (const K &k, const V &obj, dsdcl_id_t lease,
+                    cbi::ptr cb = NULL, const annotation_t *a = NULL);
+
     /*
      * @brief figure out slave the key maps to
      *
@@ -309,6 +396,13 @@ private:
 
 #define DSDC_RETRY_ON_STARTUP          0x1
 
+// ask the slaves which keys are hot, and hold GET results for those keys
+// for dsdci_hot_key_ttl seconds, so one busy key can't swamp its slave.
+// Other clients' changes to a hot key can take that long to show up.
+// A GET with a time_to_expire shorter than the time since the result
+// was fetched goes to the slave, as it would without the flag.
+#define DSDC_HOT_KEY_CACHE             0x2
+
 //
 // dsdc smart client:
 //
@@ -365,16 +459,43 @@ public:
     void put (ptr<dsdc_put3_arg_t> arg, cbi::ptr cb = NULL, bool safe = false);
     void get (ptr<dsdc_key_t> key, dsdc_get_res_cb_t cb,
               bool safe = false, int time_to_expire=-1,
-              const annotation_t *a = NULL, CLOSURE);
+              const annotation_t *a = NULL,
+              const dsdc_trace_ctx_t *tc = NULL, CLOSURE);
     void remove (ptr<dsdc_key_t> key, cbi::ptr cb = NULL, bool safe = false);
     void remove (ptr<dsdc_remove3_arg_t> arg, cbi::ptr cb = NULL,
                  bool safe = false);
-    void mget (ptr<vec<dsdc_key_t> > keys, dsdc_mget_res_cb_t cb);
+    void mget (ptr<vec<dsdc_key_t> > keys, dsdc_mget_res_cb_t cb,
+               const str &group = NULL);
     void lock_acquire (ptr<dsdc_lock_acquire_arg_t> arg,
                        dsdc_lock_acquire_res_cb_t cb, bool safe = false);
     void lock_release (ptr<dsdc_lock_release_arg_t> arg,
                        cbi::ptr cb = NULL, bool safe = false, CLOSURE);
 
+    // take several locks, granting all or none; the locks are split
+    // up by lock server, and the lock servers are visited in a fixed
+    // order, so concurrent multi-acquires can't deadlock.  Not
+    // available through the master.
+    void lock_acquire_multi (ptr<dsdc_lock_acquire_multi_arg_t> arg,
+                             dsdc_lock_multi_cb_t cb, CLOSURE);
+    void lock_release_multi (ptr<dsdc_lock_bundle_t> b, cbi::ptr cb = NULL,
+                             CLOSURE);
+
+    // read-modify-write in two round trips: lock_get () takes a lease
+    // on the key from the slave that owns it, and returns the value;
+    // put_release () puts the new value (if arg->commit) and gives up
+    // the lease.  No lock server is involved.
+    void lock_get (ptr<dsdc_lock_get_arg_t> arg, dsdc_lock_get_res_cb_t cb,
+                   CLOSURE);
+    void put_release (ptr<dsdc_put_release_arg_t> arg, cbi::ptr cb = NULL,
+                      CLOSURE);
+
+    // GET and PUT with fill leases; see dsdc_lease_get_res_t.  With
+    // a grace period, serve stale values (see dsdc_get_stale_arg_t).
+    void lease_get (ptr<dsdc_get3_arg_t> arg, dsdc_lease_get_res_cb_t cb,
+                    u_int grace = 0, CLOSURE);
+    void lease_put (ptr<dsdc_lease_put_arg_t> arg, cbi::ptr cb = NULL,
+                    CLOSURE);
+
     // slightly more automated versions of the above; call xdr2str/str2xdr
     // automatically, and therefore less code for the app designer
     template<class T> void put2 (const dsdc_key_t &k, const T &obj,
@@ -412,6 +533,16 @@ public:
     template<class K> str
     which_slave3 (const K &k);
 
+    template<class K, class V> void
+    lease_get3 (const K &k,
+                typename callback<void, dsdc_res_t, ptr<V>, dsdcl_id_t>::ref cb,
+                int time_to_expire = -1, const annotation_t *a = NULL,
+                u_int grace = 0);
+
+    template<class K, class V> void
+    lease_put3 (const K &k, const V &obj, dsdcl_id_t lease,
+                cbi::ptr cb = NULL, const annotation_t *a = NULL);
+
     template<class K> void
     lock_acquire3 (const K &k, dsdc_lock_acquire_res_cb_t cb, u_int timeout,
                    bool writer = true, bool block = true, bool safe = false);
@@ -420,7 +551,25 @@ public:
     lock_release3 (const K &k, dsdcl_id_t id, cbi::ptr cb = NULL,
                    bool safe = false);
 
-    str which_slave (const dsdc_key_t &k);
+    str which_slave (const dsdc_key_t &k, const str &group = NULL);
+
+    // the slave that owns k, or NULL if the ring is empty
+    ptr<aclnt_wrap_t> owner (const dsdc_key_t &k, const str &group = NULL);
+
+    // the RPC client for the slave that owns k; for forwarding requests
+    // without decoding them (see dsdc_raw.h).  Triggers DSDC_NONODE or
+    // DSDC_DEAD and a NULL client on failure.
+    typedef event<dsdc_res_t, ptr<aclnt> >::ref route_ev_t;
+    void route (const dsdc_key_t &k, route_ev_t ev, const str &group = NULL,
+                CLOSURE);
+
+    // Slave groups (see -G on the slave).  Keys go to the slaves of
+    // the default group, unless set_group () picked another for all
+    // of this client's calls, or for the calls made under annotation
+    // a.  The calls above that take a group name override both.  Keys
+    // routed to a group we know of no slaves in get DSDC_NONODE.
+    void set_group (const str &g) { _group = g; }
+    void set_group (const annotation_t *a, const str &g);
 
     static bool obj_too_big (const dsdc_obj_t &obj);
 
@@ -448,6 +597,7 @@ protected:
     ptr<aclnt> get_primary ();
     ptr<aclnt_wrap_t> new_wrap (const str &h, int p);
     ptr<aclnt_wrap_t> new_lockserver_wrap (const str &h, int p);
+    void release_wrap (const str &h, int p);
 
     void pre_construct ();
     void post_construct ();
@@ -456,6 +606,45 @@ protected:
                        dsdc_lock_acquire_res_cb_t cb,
                        ptr<aclnt> cli);
 
+    void release_bundle (str server, dsdcl_id_t id,
+                         event<dsdc_res_t>::ref ev, CLOSURE);
+
+    // the slave group that calls under a go to
+    str group_of (const dsdc_annotation_t &a) const;
+    str group_of (const annotation_t *a) const;
+
+    //---------------------------------------------------------------------
+    // hot keys, for DSDC_HOT_KEY_CACHE
+
+    struct hot_obj_t {
+        hot_obj_t () : _fetched (0), _expires (0) {}
+        hot_obj_t (ptr<dsdc_get_res_t> r, time_t f, time_t e)
+            : _res (r), _fetched (f), _expires (e) {}
+        ptr<dsdc_get_res_t> _res;
+        time_t _fetched;
+        time_t _expires;
+    };
+
+    // poll all slaves every dsdci_hot_key_poll_interval
+    void hot_key_loop (CLOSURE);
+    void hot_key_poll (evv_t ev, CLOSURE);
+    void hot_keys_from (ptr<dsdci_slave_t> s, dsdc_hot_keys_t *res,
+                        evv_t ev, CLOSURE);
+
+    // NULL if k isn't held, or was fetched too long ago for a caller
+    // who wants it no older than time_to_expire, as in lru_lookup ()
+    ptr<dsdc_get_res_t> hot_lookup (const dsdc_key_t &k, int time_to_expire);
+    void hot_store (const dsdc_key_t &k, ptr<dsdc_get_res_t> r);
+    void hot_invalidate (const dsdc_key_t &k)
+    { if (_hot_objs.size ()) _hot_objs.remove (k); }
+
+    bhash<dsdc_key_t, dsdck_hashfn_t, dsdck_equals_t> _hot_keys;
+    qhash<dsdc_key_t, hot_obj_t, dsdck_hashfn_t, dsdck_equals_t> _hot_objs;
+
+    //
+    // end hot keys
+    //---------------------------------------------------------------------
+
   
 
     //---------------------------------------------------------------------
@@ -467,8 +656,9 @@ protected:
     template<class T>
     struct cc_t {
         cc_t () {}
-        cc_t (const dsdc_key_t &k, ptr<T> a, int p, cbi::ptr c)
-                : key (k), arg (a), proc (p), cb (c), 
+        cc_t (const dsdc_key_t &k, ptr<T> a, int p, cbi::ptr c,
+              const str &g)
+                : key (k), arg (a), proc (p), cb (c), group (g),
 		  res (New refcounted<int> ()) {}
 
         ~cc_t () { if (cb) (*cb) (*res); }
@@ -479,12 +669,14 @@ protected:
         ptr<T> arg;
         int proc;
         cbi::ptr cb;
+        str group;
         ptr<aclnt> cli;
         ptr<int> res;
     };
 
     template<class T> void
-    change_cache (const dsdc_key_t &k, ptr<T> arg, int, cbi::ptr, bool);
+    change_cache (const dsdc_key_t &k, ptr<T> arg, int, cbi::ptr, bool,
+                  const dsdc_annotation_t *a = NULL);
 
     template<class T> void change_cache (ptr<cc_t<T> > cc, bool safe);
     template<class T> void change_cache_cb_2 (ptr<cc_t<T> > cc, clnt_stat err);
@@ -529,6 +721,9 @@ protected:
 
     vec< ptr<dsdci_proxy_t> > _proxies;
 
+    str _group;                           // NULL for the default group
+    qhash<str, str> _annotation_groups;   // annotation::key () -> group
+
     u_int _opts;
     u_int _timeout;
 };
@@ -571,9 +766,12 @@ mkkey (dsdc_key_t *k, const T &obj)
 //
 template<class T> void
 dsdc_smartcli_t::change_cache (const dsdc_key_t &k, ptr<T> arg,
-                               int proc, cbi::ptr cb, bool safe)
+                               int proc, cbi::ptr cb, bool safe,
+                               const dsdc_annotation_t *a)
 {
-    change_cache<T> (New refcounted<cc_t<T> > (k, arg, proc, cb), safe);
+    hot_invalidate (k);
+    str g = a ? group_of (*a) : _group;
+    change_cache<T> (New refcounted<cc_t<T> > (k, arg, proc, cb, g), safe);
 }
 
 template<class T> void
@@ -610,7 +808,7 @@ dsdc_smartcli_t::change_cache (ptr<cc_t<T> > cc, bool safe)
                             &dsdc_smartcli_t::change_cache_cb_1<T>, cc));
     } else {
 
-        dsdc_ring_node_t *n = _hash_ring.successor (cc->key);
+        dsdc_ring_node_t *n = successor (cc->group, cc->key);
         if (!n) {
             cc->set_res (DSDC_NONODE);
             return;
@@ -745,6 +943,52 @@ dsdc_smartcli_t::lock_acquire3 (const K &k, dsdc_lock_acquire_res_cb_t cb,
     lock_acquire (arg, cb, safe);
 }
 
+template<class T>
+class lease_get3_tame_helper {
+public:
+    lease_get3_tame_helper () {}
+    void fn (dsdc_smartcli_t *cli,
+             ptr<dsdc_get3_arg_t> arg,
+             typename callback<void, dsdc_res_t, ptr<T>, dsdcl_id_t>::ref cb,
+             u_int grace = 0, CLOSURE);
+};
+
+template<class K, class V> void
+dsdc_smartcli_t::lease_get3 (const K &k,
+                             typename callback<void, dsdc_res_t, ptr<V>,
+                                               dsdcl_id_t>::ref cb,
+                             int time_to_expire, const annotation_t *a,
+                             u_int grace)
+{
+    ptr<dsdc_get3_arg_t> arg = New refcounted<dsdc_get3_arg_t> ();
+    mkkey (&arg->key, k);
+    arg->time_to_expire = time_to_expire;
+    annotation_t::to_xdr (a, &arg->annotation);
+    lease_get3_tame_helper<V> th;
+    th.fn (this, arg, cb, grace);
+}
+
+template<class K, class V> void
+dsdc_smartcli_t::lease_put3 (const K &k, const V &obj, dsdcl_id_t lease,
+                             cbi::ptr cb, const annotation_t *a)
+{
+    ptr<dsdc_lease_put_arg_t> arg = New refcounted<dsdc_lease_put_arg_t> ();
+    mkkey (&arg->put.key, k);
+    annotation_t::to_xdr (a, &arg->put.annotation);
+    arg->lease = lease;
+
+    dsdc_res_t err = DSDC_OK;
+    if (!xdr2bytes (arg->put.obj, obj)) {
+        err = DSDC_ERRENCODE;
+    } else if (obj_too_big (arg->put.obj)) {
+        err = DSDC_TOO_BIG;
+    } else {
+        lease_put (arg, cb);
+    }
+    if (err != DSDC_OK && cb)
+        (*cb) (err);
+}
+
 template<class K, class V> str
 dsdc_iface_t<K,V>::which_slave (const K &k)
 {
@@ -783,6 +1027,25 @@ dsdc_iface_t<K,V>::lock_release (const K &k, dsdcl_id_t id,
     _cli->lock_release3 (k, id, cb, safe);
 }
 
+template<class K, class V> void
+dsdc_iface_t<K,V>::get_lease (const K &k,
+                              typename callback<void, dsdc_res_t, ptr<V>,
+                                                dsdcl_id_t>::ref cb,
+                              const annotation_t *a)
+{ _cli->template lease_get3<K,V> (k, cb, time_to_expire, a); }
+
+template<class K, class V> void
+dsdc_iface_t<K,V>::get_stale (const K &k,
+                              typename callback<void, dsdc_res_t, ptr<V>,
+                                                dsdcl_id_t>::ref cb,
+                              u_int grace, const annotation_t *a)
+{ _cli->template lease_get3<K,V> (k, cb, time_to_expire, a, grace); }
+
+template<class K, class V> void
+dsdc_iface_t<K,V>::put_lease (const K &k, const V &obj, dsdcl_id_t lease,
+                              cbi::ptr cb, const annotation_t *a)
+{ _cli->lease_put3 (k, obj, lease, cb, a); }
+
 
 //
 //-----------------------------------------------------------------------
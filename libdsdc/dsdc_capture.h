@@ -0,0 +1,66 @@
+// -*-c++-*-
+/* $Id$ */
+
+#ifndef _DSDC_CAPTURE_H_
+#define _DSDC_CAPTURE_H_
+
+#include "async.h"
+#include "dsdc_prot.h"
+
+//
+// Capture of a slave's cache traffic, for dsdc_replay to run through
+// the cache at other sizes.  The slave logs every GET, PUT and REMOVE
+// it serves for a sampled set of keys: one in <one_in>, picked by key,
+// so that a captured key has all of its traffic in the capture.  A
+// replay scales cache sizes down by the same factor.
+//
+// Records are buffered and written out as a dsdc_capture_chunk_t
+// every dsdc_capture_flush_interval seconds, or sooner once there are
+// dsdc_capture_chunk_recs of them; past dsdc_capture_max_bytes, the
+// capture moves to <path>.old and starts over.
+//
+// Each chunk lists the annotations its records use, by id.  An id is
+// for one annotation key all through a capture, including one that's
+// appended to after a restart; open () reads back the ids already in
+// the file.
+//
+
+namespace dsdc {
+
+    namespace annotation { class base_t; };
+
+    namespace capture {
+
+        //--------------------------------------------------------
+
+        bool open (const str &path, u_int one_in);
+        void close ();
+        bool capturing ();
+
+        // a key's first 8 bytes, which is all a capture keeps of it
+        u_int64_t key64 (const dsdc_key_t &k);
+
+        // log an access to k, if k is one of the sampled keys
+        void record (dsdc_capture_op_t op, const dsdc_key_t &k, size_t sz,
+                     const annotation::base_t *a);
+
+        //--------------------------------------------------------
+
+        // reads a capture back, a chunk at a time
+        class reader_t {
+        public:
+            reader_t (int fd) : _fd (fd), _err (false) {}
+            bool next (dsdc_capture_chunk_t *c);
+            bool error () const { return _err; }
+        private:
+            bool read_full (char *buf, size_t len, bool *eof);
+            const int _fd;
+            bool _err;
+        };
+
+        //--------------------------------------------------------
+
+    };
+};
+
+#endif /* _DSDC_CAPTURE_H_ */
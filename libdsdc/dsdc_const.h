@@ -15,17 +15,41 @@ extern int dsdc_retry_wait_time;
 extern u_int dsdc_rpc_timeout;
 
 extern u_int dsdc_slave_nnodes;
+extern u_int dsdc_lockserver_nnodes;
 extern size_t dsdc_slave_maxsz;
 
 extern u_int dsdc_packet_sz;
 extern u_int dsdcs_port_attempts;
 extern u_int dsdcl_default_timeout;
+extern u_int dsdcl_max_multi;
 
 extern time_t dsdci_connect_timeout_ms;
 extern time_t dsdcm_timer_interval;
+extern u_int dsdcm_state_history;
 extern int dsdc_aiod2_remote_port;
 
+extern time_t dsdc_proxy_mget_window_us;
+extern u_int dsdc_proxy_mget_max_keys;
+
 extern size_t dsdcs_clean_batch;
 extern time_t dsdcs_clean_wait_us;
+extern size_t dsdcs_stats_batch;
+extern size_t dsdcs_mrc_max_keys;
+extern size_t dsdcs_hot_key_slots;
+extern time_t dsdcs_hot_key_window;
+extern u_int dsdcs_hot_key_min_rate;
+extern time_t dsdci_hot_key_poll_interval;
+extern time_t dsdci_hot_key_ttl;
+extern size_t dsdcs_ssd_maxsz;
+extern u_int dsdcs_ssd_max_pending;
+extern time_t dsdcs_fill_lease_timeout;
+extern time_t dsdc_metrics_timeout;
+extern int dsdc_metrics_latency_min_bits;
+extern int dsdc_metrics_latency_max_bits;
+extern time_t dsdc_trace_flush_interval;
+extern size_t dsdc_trace_max_bytes;
+extern time_t dsdc_capture_flush_interval;
+extern size_t dsdc_capture_chunk_recs;
+extern size_t dsdc_capture_max_bytes;
 
 typedef event<int,str>::ref evis_t;
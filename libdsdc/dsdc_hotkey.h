@@ -0,0 +1,69 @@
+// -*-c++-*-
+/* $Id$ */
+
+#ifndef _DSDC_HOTKEY_H_
+#define _DSDC_HOTKEY_H_
+
+#include "async.h"
+#include "ihash.h"
+#include "dsdc_prot.h"
+#include "dsdc_util.h"
+
+//
+// The keys a data slave is getting the most GETs for.  It counts with
+// Space-Saving (Metwally et al., ICDT '05): dsdcs_hot_key_slots
+// counters, and a GET for a key without one takes over the smallest,
+// inheriting its count as the new key's possible error.  Any key with
+// more than 1/slots of the GETs is sure to have a counter.
+//
+// Counts start over every dsdcs_hot_key_window seconds.  The keys of
+// the last complete window that were surely over dsdcs_hot_key_min_rate
+// GETs per second are the hot ones, and smart clients can ask for them
+// with DSDC_GET_HOT_KEYS.
+//
+
+namespace dsdc {
+    namespace hotkey {
+
+        //--------------------------------------------------------
+
+        class tracker_t {
+        public:
+            tracker_t ();
+            ~tracker_t ();
+
+            void get (const dsdc_key_t &k);
+
+            // the hot keys of the last complete window
+            void to_xdr (dsdc_hot_keys_t *out);
+            size_t n_hot ();
+
+        private:
+            struct counter_t {
+                counter_t (const dsdc_key_t &k)
+                    : _key (k), _gets (1), _error (0), _pos (0) {}
+                dsdc_key_t _key;
+                u_int64_t _gets, _error;
+                size_t _pos;                  // in _heap
+                ihash_entry<counter_t> _hlnk;
+            };
+
+            void roll ();
+            void sift_up (size_t i);
+            void sift_down (size_t i);
+            void swap (size_t i, size_t j);
+
+            ihash<dsdc_key_t, counter_t, &counter_t::_key, &counter_t::_hlnk,
+                  dsdck_hashfn_t, dsdck_equals_t> _counters;
+            vec<counter_t *> _heap;           // fewest GETs first
+            time_t _start;
+            u_int64_t _gets;
+            dsdc_hot_keys_t _last;
+        };
+
+        //--------------------------------------------------------
+
+    };
+};
+
+#endif /* _DSDC_HOTKEY_H_ */
@@ -1,4 +1,3 @@
-
 // -*-c++-*-
 /* $Id$ */
 
@@ -12,6 +11,67 @@
 typedef u_int64_t dsdcl_id_t;
 typedef callback<void, dsdcl_id_t>::ref cb_lid_t;
 
+class dsdc_lock_t;
+struct dsdcl_bundle_t;
+
+/**
+ * Fixed-size objects carved out of slabs, with freed objects kept on
+ * a free list for reuse.  The lock server makes and destroys millions
+ * of short-lived locks, holders and waiters, and going to malloc for
+ * each one showed up badly in profiles.  Slabs are only given back
+ * when the pool itself goes away.
+ */
+template<class T>
+class dsdcl_pool_t {
+public:
+    dsdcl_pool_t (size_t slab = 256) : _slab (slab), _free (NULL) {}
+    ~dsdcl_pool_t ()
+    {
+        for (size_t i = 0; i < _slabs.size (); i++)
+            xfree (_slabs[i]);
+    }
+
+    // raw memory for one T; construct into it with placement new
+    void *get ()
+    {
+        if (!_free)
+            grow ();
+        slot_t *s = _free;
+        _free = s->_next;
+        return s;
+    }
+
+    // destroy t and keep its memory around for the next get ()
+    void put (T *t)
+    {
+        t->~T ();
+        slot_t *s = reinterpret_cast<slot_t *> (t);
+        s->_next = _free;
+        _free = s;
+    }
+
+private:
+    union slot_t {
+        slot_t *_next;
+        double _align;
+        char _obj[sizeof (T)];
+    };
+
+    void grow ()
+    {
+        slot_t *v = static_cast<slot_t *> (xmalloc (_slab * sizeof (slot_t)));
+        _slabs.push_back (v);
+        for (size_t i = 0; i < _slab; i++) {
+            v[i]._next = _free;
+            _free = &v[i];
+        }
+    }
+
+    const size_t _slab;
+    slot_t *_free;
+    vec<void *> _slabs;
+};
+
 class dsdcl_waiter_t {
 public:
     dsdcl_waiter_t (bool w, u_int to, cb_lid_t c) :
@@ -30,21 +90,49 @@ private:
 
 class dsdcl_holder_t {
 public:
-    dsdcl_holder_t (dsdcl_id_t i, bool w, u_int timeout = 0);
+    dsdcl_holder_t (dsdc_lock_t *l, dsdcl_id_t i, bool w, u_int timeout = 0);
     dsdcl_id_t _id;
     ihash_entry<dsdcl_holder_t> _hlnk;
-    void set_timeout (cbv::ptr cb);
-    ptr<bool> destroyed_flag () { return _destroyed; }
-    void cancel_timeout ();
     bool is_writer () const { return _writer; }
     dsdcl_id_t id () const { return _id; }
+    dsdc_lock_t *lock () const { return _lock; }
+    time_t expires () const { return _expires; }
 
+    tailq_entry<dsdcl_holder_t> _wlnk;   // for dsdcl_wheel_t
+    dsdcl_bundle_t *_bundle;             // if from LOCK_ACQUIRE_MULTI
 private:
-    timecb_t  *_timer;
+    dsdc_lock_t *_lock;
     bool      _writer;
-    time_t    _timein;
-    u_int     _timeout;
-    ptr<bool> _destroyed;
+    time_t    _expires;
+};
+
+/**
+ * A hashed timing wheel for lock timeouts, with one-second ticks.
+ * Holders hash into the slot for their expiration time; every tick
+ * looks at just the one slot that has come due, and skips over
+ * holders that are due on a later trip around the wheel.  Insert and
+ * remove are O(1), and there's only ever one sfslite timer outstanding,
+ * no matter how many locks are held.
+ */
+class dsdcl_wheel_t {
+public:
+    enum { n_slots = 512 };
+
+    dsdcl_wheel_t () : _cursor (0), _timer (NULL), _n (0) {}
+    ~dsdcl_wheel_t ();
+    void insert (dsdcl_holder_t *h);
+    void remove (dsdcl_holder_t *h);
+    size_t size () const { return _n; }
+private:
+    typedef tailq<dsdcl_holder_t, &dsdcl_holder_t::_wlnk> slot_t;
+
+    void tick ();
+    void expire_slot (slot_t *s, time_t now);
+
+    slot_t _slots[n_slots];
+    time_t _cursor;        // the next second to look at
+    timecb_t *_timer;
+    size_t _n;
 };
 
 class dsdcl_mgr_t;
@@ -58,13 +146,15 @@ public:
     dsdcl_id_t acquire_noblock (bool writer, u_int timeout);
     void acquire (bool writer, u_int timeout, cb_lid_t cb);
     bool release (dsdcl_id_t l);
-    void remove_holder (dsdcl_holder_t *h, ptr<bool> df, bool timed_out);
+    void expire_holder (dsdcl_holder_t *h);
     bool is_locked () const ;
+    dsdcl_holder_t *find_holder (dsdcl_id_t id);
     void process_queue ();
     void set_leave_in_hash () { _leave_in_hash = true; }
 private:
     dsdcl_holder_t *new_holder (bool w, u_int timeout);
     dsdcl_holder_t *waiter_to_holder (dsdcl_waiter_t *w) ;
+    void delete_holder (dsdcl_holder_t *h);
 
     // If a writer holds the lock, it is exclusively set here
     dsdcl_holder_t        *_writer;
@@ -80,7 +170,6 @@ private:
     // list of just the waiters for a shared/read lock
     tailq<dsdcl_waiter_t, &dsdcl_waiter_t::_r_lnk> _r_waiters;
 
-    ptr<bool> _destroyed;
     dsdcl_mgr_t *_mgr;
 
     // on if we should leave ourselves in the hash upon deletion;
@@ -89,6 +178,24 @@ private:
     bool _leave_in_hash;
 };
 
+/**
+ * The locks granted by one LOCK_ACQUIRE_MULTI.  Goes away when it's
+ * released, or once all of its locks have timed out or been released
+ * one by one.  An empty request gets an ID, but no bundle; releasing
+ * it gives DSDC_NOTFOUND.
+ */
+struct dsdcl_bundle_t {
+    dsdcl_bundle_t (dsdcl_id_t i) : _id (i), _live (0), _releasing (false) {}
+    dsdcl_id_t _id;
+    vec<dsdc_key_t> _keys;
+    vec<dsdcl_id_t> _ids;
+    size_t _live;            // how many of _ids are still held
+    bool _releasing;
+    ihash_entry<dsdcl_bundle_t> _hlnk;
+};
+
+struct dsdcl_multi_t;
+
 /**
  * A lock manager class for DSDC.  Implements a simple RPC-based locking
  * interface, with exclusive (write) locks and also shared (read) locks.
@@ -109,17 +216,55 @@ public:
     ~dsdcl_mgr_t ();
     void acquire (svccb *sbp);
     void release (svccb *sbp);
+    void acquire_multi (svccb *sbp);
+    void release_multi (svccb *sbp);
+
+    // the same, without RPC; 0 means the lock wasn't granted
+    dsdcl_id_t acquire_noblock (const dsdc_key_t &k, bool writer,
+                                u_int timeout);
+    void acquire (const dsdc_key_t &k, bool writer, u_int timeout,
+                  cb_lid_t cb);
+    dsdc_res_t release (const dsdc_key_t &k, dsdcl_id_t id);
+    // whether id holds k; with writer, only if it holds it exclusively
+    bool holds (const dsdc_key_t &k, dsdcl_id_t id, bool writer = false);
+
+    // sorts and dedups a's locks, then takes them in order; the
+    // callback gets the bundle ID, or 0 if nothing was granted.
+    void acquire_multi (const dsdc_lock_acquire_multi_arg_t &a, cb_lid_t cb);
+    dsdc_res_t release_multi (dsdcl_id_t bundle);
+
+    size_t n_locks () const { return _locks.size (); }
+    size_t n_holders () const { return _wheel.size (); }
 
     friend class dsdc_lock_t;
 private:
     // dsdc_lock_t should be able to access these, but no one who
     // is just using the public interface to this class.
     dsdc_lock_t *find_lock (const dsdc_key_t &k) { return _locks[k]; }
+    dsdc_lock_t *get_lock (const dsdc_key_t &k);
     void insert (dsdc_lock_t *l) { _locks.insert (l); }
     void remove (dsdc_lock_t *l) { _locks.remove (l); }
+    void delete_lock (dsdc_lock_t *l) { _lock_pool.put (l); }
+
+    // a bundled lock was released or timed out on its own
+    void unbundle (dsdcl_holder_t *h);
+
+    void multi_step (dsdcl_multi_t *m);
+    void multi_granted (dsdcl_multi_t *m, dsdcl_id_t id);
+    void multi_fail (dsdcl_multi_t *m);
+    void multi_done (dsdcl_multi_t *m);
 
     ihash<dsdc_key_t, dsdc_lock_t,
     &dsdc_lock_t::_key, &dsdc_lock_t::_hlnk> _locks;
+
+    ihash<dsdcl_id_t, dsdcl_bundle_t,
+    &dsdcl_bundle_t::_id, &dsdcl_bundle_t::_hlnk> _bundles;
+
+    // the wheel comes after the pools so that it is destroyed first
+    dsdcl_pool_t<dsdc_lock_t> _lock_pool;
+    dsdcl_pool_t<dsdcl_holder_t> _holder_pool;
+    dsdcl_pool_t<dsdcl_waiter_t> _waiter_pool;
+    dsdcl_wheel_t _wheel;
 };
 
 #endif /* _DSDC_LOCK_H */
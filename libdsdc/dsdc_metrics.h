@@ -0,0 +1,75 @@
+// -*-c++-*-
+/* $Id$ */
+
+#ifndef _DSDC_METRICS_H_
+#define _DSDC_METRICS_H_
+
+#include "async.h"
+#include "arpc.h"
+
+class dsdc_app_t;
+
+//
+// A plain-text metrics page, in the Prometheus text format, served
+// over HTTP on a port bound to the loopback interface, so that a
+// scraper on the same box can read it without any RPC tooling.  Turn
+// it on with -m <port>.  The page has the process's RPC counters and
+// latency histograms (see dsdc_rpcstats.h), whatever the app adds in
+// output_metrics (), and anything registered with add_source ().
+//
+
+namespace dsdc {
+    namespace metrics {
+
+        //--------------------------------------------------------
+
+        // one sample per line, with a # TYPE line before the first
+        // sample of each metric.
+        class out_t {
+        public:
+            out_t (strbuf &b) : _b (b) {}
+            void counter (const char *n, u_int64_t v, const str &l = NULL);
+            void gauge (const char *n, int64_t v, const str &l = NULL);
+
+            // n_bucket, n_sum and n_count; le[i] are the upper bounds,
+            // and cum[i] the number of samples at or below each, and
+            // the +Inf bucket has count.
+            void histogram (const char *n, const vec<u_int64_t> &le,
+                            const vec<u_int64_t> &cum, u_int64_t sum,
+                            u_int64_t count, const str &l = NULL);
+        private:
+            void type (const char *n, const char *t);
+            void name (const char *n, const str &l);
+            void bucket (const char *n, const str &l, const char *le,
+                         u_int64_t v);
+
+            strbuf &_b;
+            str _last;
+        };
+
+        // k="v", for the labels argument above
+        str label (const char *k, const str &v);
+
+        //--------------------------------------------------------
+
+        // Extra sections, such as an fscache engine's stats.  The
+        // handle is for remove_source ().
+        typedef callback<void, out_t *>::ref source_t;
+        size_t add_source (source_t s);
+        void remove_source (size_t h);
+
+        // the page, as served
+        str page (dsdc_app_t *app);
+
+        // serve on 127.0.0.1:port; false if we couldn't bind
+        bool start (dsdc_app_t *app, int port);
+
+        // stop serving, e.g., in a forked worker
+        void stop ();
+
+        //--------------------------------------------------------
+
+    };
+};
+
+#endif /* _DSDC_METRICS_H_ */
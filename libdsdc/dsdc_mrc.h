@@ -0,0 +1,110 @@
+// -*-c++-*-
+/* $Id$ */
+
+#ifndef _DSDC_MRC_H_
+#define _DSDC_MRC_H_
+
+#include "async.h"
+#include "ihash.h"
+#include "qhash.h"
+#include "dsdc_prot.h"
+#include "dsdc_stats.h"
+
+//
+// A running estimate of a slave's miss ratio curve: the fraction of
+// GETs that would miss in an LRU cache of any given size.  It follows
+// SHARDS (Waldspurger et al., FAST '15): it tracks the reuse distance
+// of a spatially sampled subset of the keys, those whose low bits are
+// all zero, and scales the result up by the sampling rate.
+//
+// The sample is kept to dsdcs_mrc_max_keys keys.  When it grows past
+// that, the rate halves, and the keys that no longer qualify are
+// dropped; counts taken before then are already scaled, and stay.
+// Keys outside the sample cost a mask and a compare.
+//
+// Reuse distances are in bytes, as the slave counts them against -s,
+// so they can be read against cache sizes directly.  Per-annotation
+// curves are for the cache as a whole: they say how each annotation's
+// GETs would fare if the whole slave were bigger or smaller.
+//
+
+namespace dsdc {
+    namespace mrc {
+
+        //--------------------------------------------------------
+
+        class estimator_t {
+        public:
+            estimator_t ();
+            ~estimator_t ();
+
+            // a GET for k, under annotation a (if any)
+            void get (const dsdc_key_t &k, const annotation::base_t *a);
+
+            // k was stored, and takes sz bytes
+            void put (const dsdc_key_t &k, size_t sz);
+
+            // k was removed; the next GET for it is cold
+            void remove (const dsdc_key_t &k);
+
+            // fills in all but maxsz and lrusz
+            void to_xdr (dsdc_slave_mrc_t *out) const;
+
+            // restart the counts, but keep the sampled keys
+            void clear ();
+
+        private:
+            struct key_t {
+                key_t (u_int64_t k) : _key (k), _t (0), _sz (0) {}
+                u_int64_t _key;
+                u_int64_t _t;          // when last touched; 0 if never
+                u_int64_t _sz;
+                ihash_entry<key_t> _hlnk;
+            };
+
+            struct curve_t {
+                curve_t () : _gets (0), _cold (0) {}
+                void add (bool cold, u_int64_t d, u_int64_t w);
+                void to_xdr (dsdc_mrc_t *out) const;
+                u_int64_t _gets, _cold;
+                stats::sketch_t _distance;
+            };
+
+            key_t *lookup (const dsdc_key_t &k);
+            key_t *insert (const dsdc_key_t &k);
+            void touch (key_t *e, u_int64_t sz);   // now, at sz bytes
+            void drop (key_t *e);
+            u_int64_t next_time ();
+            void halve_rate ();
+            void renumber ();
+
+            // a Fenwick tree over the times keys were last touched,
+            // of their sizes, for the bytes touched since a given time
+            void fw_add (u_int64_t t, u_int64_t d);
+            u_int64_t fw_sum (u_int64_t t) const;
+
+            ihash<u_int64_t, key_t, &key_t::_key, &key_t::_hlnk> _keys;
+            vec<u_int64_t> _fw;
+            u_int64_t _now;
+            u_int64_t _mask;           // sample keys with none of these
+            curve_t _all;
+            qhash<const annotation::base_t *, curve_t *> _by_annotation;
+            vec<const annotation::base_t *> _annotations;
+            time_t _since;
+        };
+
+        //--------------------------------------------------------
+
+        // the fraction of m's GETs that would miss in a cache of sz
+        // bytes, to within the sketch's precision
+        double miss_ratio (const dsdc_mrc_t &m, u_int64_t sz);
+
+        // add up the whole-slave curves of several slaves
+        void merge (dsdc_mrc_t *out, const dsdc_mrc_t &in);
+
+        //--------------------------------------------------------
+
+    };
+};
+
+#endif /* _DSDC_MRC_H_ */
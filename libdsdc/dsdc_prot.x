@@ -79,7 +79,11 @@ enum dsdc_res_t {
   DSDC_DATA_CHANGED = 13,       /* checksum commit precondition failed */
   DSDC_DATA_DISAPPEARED = 14,   /* as above, but data disappeared */
   DSDC_TOO_BIG = 15,            /* packet was too big; don't send */
-  DSDC_EXPIRED = 16             /* current entry is still in dsdc, but expired */
+  DSDC_EXPIRED = 16,            /* current entry is still in dsdc, but expired */
+  DSDC_RETRY = 17,              /* another client is filling this key */
+  DSDC_STALE_LEASE = 18,        /* fill lease timed out or was voided */
+  DSDC_EXPIRED_STALE = 19,      /* expired, but here's the old value */
+  DSDC_NOROOM = 20              /* every partition is at its minimum */
 };
 
 /*
@@ -194,6 +198,126 @@ struct dsdc_slave_statistic_t {
 
 typedef dsdc_slave_statistic_t dsdc_slave_statistics_t<>;
 
+/*
+ * Mergeable versions of the histograms above, for adding up stats
+ * over several slaves, which the fixed linear buckets can't do.  They
+ * use the same log-linear buckets as the RPC latency histograms, sent
+ * by lower bound, nonempty ones only.  Values aren't scaled.
+ */
+struct dsdc_sketch_bucket_t {
+	unsigned hyper lo;
+	unsigned hyper n;
+};
+
+struct dsdc_sketch_t {
+	unsigned hyper n;
+	unsigned hyper sum;
+	unsigned hyper min;
+	unsigned hyper max;
+	dsdc_sketch_bucket_t buckets<>;
+};
+
+struct dsdc_dataset_sketches_t {
+	dsdc_sketch_t gets;
+	dsdc_sketch_t objsz;
+	dsdc_sketch_t do_gets;
+	dsdc_sketch_t do_lifetime;
+	dsdc_sketch_t do_objsz;
+	dsdc_sketch_t *lifetime;
+};
+
+/*
+ * An annotation's partition of a slave's cache (dsdc -Q), if it has
+ * one.  min and max are its guarantee and its limit (0 for none).
+ */
+struct dsdc_partition_stats_t {
+	unsigned hyper min;
+	unsigned hyper max;
+	unsigned hyper bytes;
+	unsigned hyper objects;
+	unsigned hyper evictions;       /* to make room for PUTs */
+	unsigned hyper evicted_bytes;
+};
+
+struct dsdc_statistic2_t {
+	dsdc_statistic_t stat;
+	dsdc_dataset_sketches_t epoch_sketches;
+	dsdc_dataset_sketches_t alltime_sketches;
+	dsdc_partition_stats_t *partition;
+};
+
+typedef dsdc_statistic2_t dsdc_statistics2_t<>;
+
+union dsdc_get_stats_single2_res_t switch (dsdc_res_t status) {
+case DSDC_OK:
+	dsdc_statistics2_t stats;
+default:
+	void;
+};
+
+struct dsdc_slave_statistic2_t {
+	dsdc_hostname_t   host;
+	dsdc_get_stats_single2_res_t stats;
+};
+
+/*
+ * merged has one entry per annotation, added up over all the slaves
+ * that answered.  Its dsdc_histogram_t's keep their counts, totals
+ * and extremes, but no buckets; use the sketches for those.
+ */
+struct dsdc_get_stats2_res_t {
+	dsdc_slave_statistic2_t slaves<>;
+	dsdc_statistics2_t merged;
+};
+
+/*
+ * A slave's estimate of its miss ratio curve, from a sample of its
+ * keys (see dsdc_mrc.h).  Counts are scaled up to the whole slave.
+ * A GET for a key that was last seen distance bytes ago would have
+ * hit in an LRU cache of that many bytes; a cold GET would have
+ * missed in any of them.
+ */
+struct dsdc_mrc_t {
+	unsigned hyper gets;
+	unsigned hyper cold;        /* first GETs for a key, or after a remove */
+	dsdc_sketch_t distance;     /* of the other GETs, in bytes */
+};
+
+struct dsdc_mrc_annotated_t {
+	dsdc_annotation_t annotation;
+	dsdc_mrc_t mrc;             /* in the cache as a whole */
+};
+
+struct dsdc_slave_mrc_t {
+	unsigned one_in;            /* 1 in one_in keys are sampled */
+	unsigned tracked;           /* sampled keys held now */
+	unsigned hyper since;       /* when the counts started */
+	unsigned hyper maxsz;       /* the cache's size, and ... */
+	unsigned hyper lrusz;       /* ... what it holds now */
+	dsdc_mrc_t all;
+	dsdc_mrc_annotated_t annotations<>;
+};
+
+/*
+ * The keys a data slave saw the most GETs for in its last complete
+ * window (see dsdc_hotkey.h), of those at or over min_rate GETs per
+ * second, hottest first.  Counts are upper bounds; gets - error is a
+ * lower bound.
+ */
+struct dsdc_hot_key_t {
+	dsdc_key_t key;
+	unsigned hyper gets;
+	unsigned hyper error;
+};
+
+struct dsdc_hot_keys_t {
+	unsigned hyper start;       /* when the window started */
+	unsigned window;            /* its length, in seconds */
+	unsigned hyper gets;        /* GETs for all keys in it */
+	unsigned min_rate;
+	dsdc_hot_key_t keys<>;
+};
+
 /*
  * End statistic structures
  *=======================================================================
@@ -277,7 +401,31 @@ struct dsdcx_slave_t {
 	int port;
 };
 
+/*
+ * Slave groups.  A slave that registers with a group name serves only
+ * keys routed to that group, on a ring of its own; everything else goes
+ * to the default group, the slaves that registered without one.  Older
+ * clients, which know nothing of groups, see just the default group:
+ * groups only go out in GETSTATE2's replies.
+ */
+struct dsdcx_group_t {
+	string name<>;
+	dsdcx_slave_t slaves<>;
+};
+
 struct dsdcx_state_t {
+	dsdcx_slave_t slaves<>;       /* the default group */
+	dsdcx_slave_t *lock_server;
+	dsdcx_group_t groups<>;       /* all the others */
+};
+
+/*
+ * dsdcx_state_t as it was before slave groups, and before the per-slave
+ * state hash.  It's what DSDC_GETSTATE replies with, so that clients
+ * that still poll with it can decode the reply, and they send back the
+ * SHA1 of its encoding.
+ */
+struct dsdcx_legacy_state_t {
 	dsdcx_slave_t slaves<>;
 	dsdcx_slave_t *lock_server;
 };
@@ -288,14 +436,128 @@ struct dsdc_register_arg_t {
 	bool lock_server;
 };
 
+struct dsdc_register2_arg_t {
+	dsdc_register_arg_t reg;
+	string group<>;               /* empty for the default group */
+};
+
 
 union dsdc_getstate_res_t switch (bool needupdate) {
 case true:
-	dsdcx_state_t state;
+	dsdcx_legacy_state_t state;
 case false:
 	void;
 };
 
+/*
+ * Incremental state updates.  The master numbers each version of the
+ * system state with an epoch; the incarnation is picked when the master
+ * starts up, so that epochs from two different masters (or two runs of
+ * the same master) are never confused.
+ */
+struct dsdcx_slave_id_t {
+	string hostname<>;
+	int port;
+};
+
+struct dsdcx_state_delta_t {
+	dsdcx_slave_id_t removed<>;   /* slaves to drop from the ring */
+	dsdcx_slave_t    added<>;     /* slaves to insert into the ring */
+	dsdcx_slave_t    *lock_server;
+	dsdcx_slave_t    lock_servers<>;  /* all of them, not a delta */
+	dsdcx_group_t    groups<>;    /* ... into the rings of named groups */
+};
+
+/*
+ * Lock servers register ring nodes just like data slaves, and locks
+ * are partitioned over them by key.  lock_server in dsdcx_state_t is
+ * still filled in (with the first lock server) for older clients.
+ */
+struct dsdcx_full_state_t {
+	dsdcx_state_t state;
+	dsdcx_slave_t lock_servers<>;
+};
+
+struct dsdc_getstate2_arg_t {
+	unsigned hyper incarnation;
+	unsigned hyper epoch;         /* 0 if the caller has no state yet */
+};
+
+enum dsdc_state_update_typ_t {
+	DSDC_STATE_CURRENT = 0,       /* caller is up-to-date */
+	DSDC_STATE_DELTA = 1,         /* apply the given changes */
+	DSDC_STATE_FULL = 2           /* replace everything */
+};
+
+union dsdc_state_update_t switch (dsdc_state_update_typ_t typ) {
+case DSDC_STATE_DELTA:
+	dsdcx_state_delta_t delta;
+case DSDC_STATE_FULL:
+	dsdcx_full_state_t full;
+default:
+	void;
+};
+
+struct dsdc_getstate2_res_t {
+	unsigned hyper incarnation;
+	unsigned hyper epoch;
+	dsdc_key_t hash;              /* hash of the master's full state */
+	dsdc_state_update_t update;
+};
+
+/*
+ * Per-procedure RPC counters and latency histograms, as kept by each
+ * slave, lock server and master (see dsdc_rpcstats.h), since it
+ * started or was last reset.
+ */
+struct dsdc_histogram_bucket_t {
+	unsigned hyper usec;      /* the bucket's lower bound */
+	unsigned hyper n;
+};
+
+/*
+ * per-procedure counters that dsdc proxy workers report to their
+ * parent, which sums them up for logging, and merges them into its
+ * own dsdc_rpc_stats_t.
+ */
+struct dsdc_proxy_proc_stats_t {
+	unsigned proc;
+	unsigned hyper calls;
+	unsigned hyper errors;
+	unsigned hyper usec;
+	unsigned hyper usec_max;
+	dsdc_histogram_bucket_t latency<>;    /* nonempty buckets only */
+};
+
+typedef dsdc_proxy_proc_stats_t dsdc_proxy_stats_t<>;
+
+struct dsdc_rpc_proc_stats_t {
+	unsigned proc;
+	unsigned hyper calls;
+	unsigned hyper errors;
+	unsigned hyper bytes_in;  /* object bytes only, for GETs and PUTs */
+	unsigned hyper bytes_out;
+	unsigned hyper usec;      /* summed over all calls */
+	unsigned hyper usec_max;
+	dsdc_histogram_bucket_t latency<>;    /* nonempty buckets only */
+};
+
+struct dsdc_rpc_stats_t {
+	unsigned hyper since;
+	unsigned hyper now;
+	dsdc_rpc_proc_stats_t procs<>;
+};
+
+/*
+ * pushed from the master to subscribers whenever the system state
+ * changes; subscribers with a matching (incarnation, epoch) can
+ * ignore it, and everyone else should GETSTATE2.
+ */
+struct dsdc_state_changed_arg_t {
+	unsigned hyper incarnation;
+	unsigned hyper epoch;
+};
+
 union dsdc_lock_acquire_res_t switch (dsdc_res_t status) {
 case DSDC_OK:
 	unsigned hyper lockid;
@@ -317,6 +579,141 @@ struct dsdc_lock_release_arg_t {
 	unsigned hyper lockid;    // provide the lock-ID to catch bugs
 };
 
+/*
+ * Several locks in one go.  The lock server takes them in key order,
+ * so that two multi-acquires can never deadlock, and grants either all
+ * of them or none.  What comes back is one bundle ID that releases
+ * them all.
+ */
+struct dsdc_lock_multi_1_t {
+	dsdc_key_t key;
+	bool writer;
+};
+
+struct dsdc_lock_acquire_multi_arg_t {
+	dsdc_lock_multi_1_t locks<>;
+	bool block;
+	unsigned timeout;
+};
+
+union dsdc_lock_acquire_multi_res_t switch (dsdc_res_t status) {
+case DSDC_OK:
+	unsigned hyper bundleid;
+case DSDC_RPC_ERROR:
+	unsigned err;
+default:
+	void;
+};
+
+/*
+ * Lock-and-get and put-and-release, both served by the slave that owns
+ * the key, for read-modify-write in two round trips.  The lease is an
+ * advisory lock that the slave keeps; plain PUTs don't look at it.
+ */
+struct dsdc_lock_get_arg_t {
+	dsdc_get3_arg_t get;
+	bool writer;
+	bool block;
+	unsigned timeout;         /* lease length, in seconds */
+};
+
+struct dsdc_lock_get_res_t {
+	dsdc_lock_acquire_res_t lease;
+	dsdc_get_res_t data;      /* DSDC_LOCKED if no lease was granted */
+};
+
+struct dsdc_put_release_arg_t {
+	dsdc_put4_arg_t put;
+	bool commit;              /* false to give up the lease, no put */
+	unsigned hyper leaseid;
+};
+
+/*
+ * Fill leases, so that a miss on a hot key doesn't send every reader
+ * to the database at once.  A LEASE_GET miss hands a lease to the
+ * first caller only; until that caller fills the key with LEASE_PUT,
+ * or the lease times out, everyone else gets DSDC_RETRY, along with
+ * the expired value if there was one.  A PUT or REMOVE of the key in
+ * the meantime voids the lease, so that a fill computed from data
+ * that has since changed gets DSDC_STALE_LEASE instead of landing.
+ */
+struct dsdc_lease_get_res_t {
+	dsdc_get_res_t res;
+	unsigned hyper lease;     /* nonzero if this caller should fill */
+	dsdc_obj_t *stale;        /* with DSDC_EXPIRED_STALE, maybe DSDC_RETRY */
+};
+
+/*
+ * GET_STALE is LEASE_GET with stale-while-revalidate: an object that
+ * expired less than grace seconds ago stays in the cache, and comes
+ * back with DSDC_EXPIRED_STALE.  The first caller to see it stale
+ * also gets a fill lease, and should refresh the object in the
+ * background; everyone else just uses the stale value.
+ */
+struct dsdc_get_stale_arg_t {
+	dsdc_get3_arg_t get;
+	unsigned grace;
+};
+
+struct dsdc_lease_put_arg_t {
+	dsdc_put4_arg_t put;
+	unsigned hyper lease;
+};
+
+/*
+ * A sampled trace.  Every hop that handles a GET_TRACED logs its spans
+ * under trace_id (see dsdc_trace.h), and passes the trace on with its
+ * own span as the parent.
+ */
+struct dsdc_trace_ctx_t {
+	unsigned hyper trace_id;
+	unsigned hyper parent_id;   /* the caller's span */
+};
+
+struct dsdc_get_traced_arg_t {
+	dsdc_get3_arg_t get;        /* first, for raw forwarding */
+	dsdc_trace_ctx_t trace;
+};
+
+/*
+ * A capture of a slave's cache traffic, for replay with dsdc_replay
+ * (see dsdc_capture.h).  Keys are sampled, not requests: a key that's
+ * in the capture has all of its traffic in it.  GET_STALE is an
+ * expired object served in its grace period; the slave counts it as
+ * expired, not as a hit.
+ */
+enum dsdc_capture_op_t {
+	DSDC_CAPTURE_GET_HIT = 0,
+	DSDC_CAPTURE_GET_MISS = 1,
+	DSDC_CAPTURE_PUT = 2,
+	DSDC_CAPTURE_REMOVE = 3,
+	DSDC_CAPTURE_GET_STALE = 4
+};
+
+struct dsdc_capture_rec_t {
+	dsdc_capture_op_t op;
+	unsigned hyper key;         /* the key's first 8 bytes */
+	unsigned usec;              /* since the chunk's start */
+	unsigned size;              /* of the object; 0 on a miss */
+	unsigned annotation;        /* 0 for none */
+};
+
+struct dsdc_capture_annotation_t {
+	unsigned id;
+	dsdc_annotation_t annotation;
+};
+
+/*
+ * The capture file is a sequence of chunks, each one a 4-byte length
+ * in network order followed by the XDR'ed chunk.
+ */
+struct dsdc_capture_chunk_t {
+	unsigned hyper start_usec;  /* since the epoch */
+	unsigned one_in;            /* 1 in one_in keys are captured */
+	dsdc_capture_annotation_t annotations<>;  /* the ones used below */
+	dsdc_capture_rec_t recs<>;
+};
+
 /* ------------------------------------------------------------- */
 /* aiod2 data */
 
@@ -533,6 +930,108 @@ program DSDC_PROG
 	 dsdc_res_t
 	 DSDC_PUT4(dsdc_put4_arg_t) = 21;
 
+	/*
+	 * like GETSTATE, but only ship the slaves that were added or
+	 * removed since the caller's epoch.
+	 */
+	 dsdc_getstate2_res_t
+	 DSDC_GETSTATE2(dsdc_getstate2_arg_t) = 22;
+
+	/*
+	 * ask the master to push DSDC_STATE_CHANGED back to us over this
+	 * connection whenever the ring changes.  lasts as long as the
+	 * connection does.
+	 */
+	 dsdc_res_t
+	 DSDC_SUBSCRIBE(void) = 23;
+
+	/*
+	 * master -> subscriber, over the subscriber's own connection.
+	 */
+	 void
+	 DSDC_STATE_CHANGED(dsdc_state_changed_arg_t) = 24;
+
+	/*
+	 * lock servers only; see dsdc_lock_acquire_multi_arg_t.  The
+	 * release takes the bundle ID.
+	 */
+	 dsdc_lock_acquire_multi_res_t
+	 DSDC_LOCK_ACQUIRE_MULTI(dsdc_lock_acquire_multi_arg_t) = 25;
+
+	 dsdc_res_t
+	 DSDC_LOCK_RELEASE_MULTI(unsigned hyper) = 26;
+
+	/*
+	 * data slaves only; see dsdc_lock_get_arg_t.  PUT_RELEASE gives
+	 * DSDC_NOTFOUND, and doesn't put, if the lease isn't held, and
+	 * DSDC_LOCKED, and keeps the lease, if it commits under a reader's
+	 * lease.
+	 */
+	 dsdc_lock_get_res_t
+	 DSDC_LOCK_GET(dsdc_lock_get_arg_t) = 27;
+
+	 dsdc_res_t
+	 DSDC_PUT_RELEASE(dsdc_put_release_arg_t) = 28;
+
+	/*
+	 * data slaves only; see dsdc_lease_get_res_t.
+	 */
+	 dsdc_lease_get_res_t
+	 DSDC_LEASE_GET(dsdc_get3_arg_t) = 29;
+
+	 dsdc_res_t
+	 DSDC_LEASE_PUT(dsdc_lease_put_arg_t) = 30;
+
+	 dsdc_lease_get_res_t
+	 DSDC_GET_STALE(dsdc_get_stale_arg_t) = 31;
+
+	/*
+	 * served by slaves, lock servers and masters, each for itself.
+	 * true to reset the counters after reading them.
+	 */
+	 dsdc_rpc_stats_t
+	 DSDC_GET_RPC_STATS(bool) = 32;
+
+	/*
+	 * GET_STATS_SINGLE and GET_STATS, with sketches.  Slaves serve
+	 * the first, and the master the second, fanning out to slaves.
+	 * A slave gives DSDC_ERR to either single call while it's still
+	 * sweeping for another.
+	 */
+	 dsdc_get_stats_single2_res_t
+	 DSDC_GET_STATS_SINGLE2(dsdc_get_stats_single_arg_t) = 33;
+
+	 dsdc_get_stats2_res_t
+	 DSDC_GET_STATS2(dsdc_get_stats_arg_t) = 34;
+
+	/*
+	 * GET3, with a trace context; smart clients send it for sampled
+	 * requests only.  Served by slaves, masters and proxies.
+	 */
+	 dsdc_get_res_t
+	 DSDC_GET_TRACED(dsdc_get_traced_arg_t) = 35;
+
+	/*
+	 * a data slave's miss ratio curve; true to restart the counts
+	 * after reading them.
+	 */
+	 dsdc_slave_mrc_t
+	 DSDC_GET_MRC(bool) = 36;
+
+	/*
+	 * a data slave's hot keys; smart clients with DSDC_HOT_KEY_CACHE
+	 * poll for them.
+	 */
+	 dsdc_hot_keys_t
+	 DSDC_GET_HOT_KEYS(void) = 37;
+
+	/*
+	 * REGISTER, for a slave in a named group.  Slaves in the default
+	 * group still use REGISTER, so they can talk to older masters.
+	 */
+	 dsdc_res_t
+	 DSDC_REGISTER2(dsdc_register2_arg_t) = 38;
+
 
 	} = 1;
 } = 30002;
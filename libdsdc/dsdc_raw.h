@@ -0,0 +1,41 @@
+// -*- mode: c++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+
+#pragma once
+
+#include "async.h"
+#include "arpc.h"
+#include "dsdc_prot.h"
+
+//
+// Raw passthrough forwarding.
+//
+// The master and proxy don't need to understand GET/PUT/REMOVE
+// arguments or results, only which slave the key maps to.  Every such
+// argument starts with its dsdc_key_t, so on the way in we keep the
+// argument as undecoded XDR bytes and peek the key off the front; on
+// the way out, we hand those bytes to the slave's aclnt as-is, and do
+// the same for the reply.  arpc still does the framing, so the only
+// thing that changes in the message is the XID.
+//
+
+struct dsdc_raw_msg_t {
+    str _bytes;       // the XDR-encoded argument or result
+    dsdc_key_t _key;  // for arguments, the first DSDC_KEYSIZE bytes
+};
+
+// encode/decode/free a dsdc_raw_msg_t; for use as xdrproc_t's.  The
+// argument one peeks the key, and fails on anything shorter; the
+// result one takes whatever bytes are there.
+extern xdrproc_t dsdc_xdr_raw_arg;
+extern xdrproc_t dsdc_xdr_raw_res;
+
+// true for procedures that can be forwarded this way
+bool dsdc_raw_forwardable (u_int32_t proc);
+
+// dsdc_prog_1, except that forwardable procedures take and return
+// dsdc_raw_msg_t's.  Serve with this instead of dsdc_prog_1 to
+// get raw arguments for those procedures.
+const rpc_program &dsdc_raw_prog_1 ();
+
+// reply with an error, encoded as the procedure's real result type
+void dsdc_raw_reply_error (svccb *sbp, dsdc_res_t r);
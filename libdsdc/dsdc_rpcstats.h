@@ -0,0 +1,134 @@
+// -*-c++-*-
+/* $Id$ */
+
+#ifndef _DSDC_RPCSTATS_H_
+#define _DSDC_RPCSTATS_H_
+
+#include "async.h"
+#include "arpc.h"
+#include "dsdc_prot.h"
+
+//
+// Per-procedure RPC counters and latency histograms, kept by every
+// slave, lock server and master, and served by DSDC_GET_RPC_STATS.
+// Each process runs one event loop, so the counters are plain
+// integers, and recording a call costs a clock read and a few adds.
+//
+
+namespace dsdc {
+    namespace rpcstats {
+
+        //--------------------------------------------------------
+
+        //
+        // A log-linear latency histogram, in the style of HdrHistogram:
+        // each power of two is split into 16 linear buckets, so every
+        // value lands in a bucket no more than 1/16th wider than it.
+        // Values are microseconds; anything past 2^40 (~12 days) goes
+        // in the last bucket.
+        //
+        class histogram_t {
+        public:
+            enum { sub_bits = 4,
+                   max_bits = 40,
+                   n_sub = 1 << sub_bits,
+                   n_buckets = (max_bits - sub_bits + 1) << sub_bits };
+
+            histogram_t () { clear (); }
+            void insert (u_int64_t v) { _n[bucket (v)]++; }
+            void clear () { bzero (_n, sizeof (_n)); }
+            void to_xdr (rpc_vec<dsdc_histogram_bucket_t, RPC_INFINITY> *out)
+                const;
+
+            // add in buckets from another histogram's to_xdr ()
+            void merge (const rpc_vec<dsdc_histogram_bucket_t,
+                                      RPC_INFINITY> &in);
+
+            static size_t bucket (u_int64_t v);
+            static u_int64_t lower_bound (size_t i);
+        private:
+            u_int64_t _n[n_buckets];
+        };
+
+        //--------------------------------------------------------
+
+        struct proc_t {
+            proc_t () { clear (); }
+            void clear ();
+            void to_xdr (dsdc_rpc_proc_stats_t *out) const;
+
+            u_int64_t _calls;
+            u_int64_t _errors;
+            u_int64_t _bytes_in;
+            u_int64_t _bytes_out;
+            u_int64_t _usec;
+            u_int64_t _usec_max;
+            histogram_t _latency;
+        };
+
+        //--------------------------------------------------------
+
+        class table_t {
+        public:
+            table_t () : _since (sfs_get_timenow ()) {}
+            ~table_t ();
+
+            void end_call (u_int32_t proc, const timespec &start,
+                           bool err = false);
+
+            // object bytes carried by a call, for GETs and PUTs; these
+            // are payload bytes, not bytes on the wire.
+            void bytes (u_int32_t proc, size_t in, size_t out);
+
+            // calls counted elsewhere, e.g., by proxy workers, which
+            // ship sums and histograms but no byte counts.
+            void add (u_int32_t proc, const dsdc_proxy_proc_stats_t &s);
+
+            void to_xdr (dsdc_rpc_stats_t *out) const;
+            void clear ();
+
+            // serve DSDC_GET_RPC_STATS
+            void reply (svccb *sbp);
+        private:
+            proc_t *get (u_int32_t proc);
+
+            vec<proc_t *> _procs;  // indexed by proc number
+            time_t _since;
+        };
+
+        table_t *table ();
+
+        //--------------------------------------------------------
+
+        //
+        // Times one call, and records it when it goes out of scope.
+        // Put one on the stack in dispatch () for handlers that reply
+        // right away, and cancel () it for those that reply later on;
+        // they keep a timer of their own (in their closure, or held
+        // by a ptr<> in their callback) until they reply.
+        //
+        class timer_t {
+        public:
+            timer_t (svccb *sbp)
+                : _proc (sbp ? sbp->proc () : 0), _on (sbp), _err (false),
+                  _start (sfs_get_tsnow ()) {}
+            ~timer_t () { if (_on) table ()->end_call (_proc, _start, _err); }
+            void cancel () { _on = false; }
+            void set_error () { _err = true; }
+        private:
+            const u_int32_t _proc;
+            bool _on;
+            bool _err;
+            const timespec _start;
+        };
+
+        //--------------------------------------------------------
+
+        // the latency below which a fraction p of the calls in s fell,
+        // to within the histogram's precision.
+        u_int64_t percentile (const dsdc_rpc_proc_stats_t &s, double p);
+
+    };
+};
+
+#endif /* _DSDC_RPCSTATS_H_ */
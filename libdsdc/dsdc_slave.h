@@ -17,11 +17,21 @@
 #include "arpc.h"
 #include "qhash.h"
 #include "dsdc_stats.h"
+#include "dsdc_rpcstats.h"
+#include "dsdc_metrics.h"
+#include "dsdc_trace.h"
+#include "dsdc_capture.h"
+#include "dsdc_mrc.h"
+#include "dsdc_hotkey.h"
+#include "dsdc_ssd.h"
 #include "litetime.h"
 
+struct dsdcs_partition_t;
+
 struct dsdc_cache_obj_t {
     dsdc_cache_obj_t () : _timein (sfs_get_timenow ()), _annotation (NULL),
-            _n_gets (0), _n_gets_in_epoch (0) {}
+            _n_gets (0), _n_gets_in_epoch (0), _partition (NULL),
+            _touched (0) {}
     void reset () { _timein = sfs_get_timenow (); }
     void set (const dsdc_key_t &k, const dsdc_obj_t &o,
               dsdc::annotation::base_t *a = NULL);
@@ -30,8 +40,10 @@ struct dsdc_cache_obj_t {
     void inc_gets () { _n_gets ++; _n_gets_in_epoch ++; }
     const dsdc::annotation::base_t *annotation () const { return _annotation; }
     dsdc::annotation::base_t *annotation () { return _annotation; }
-    size_t size () const
-    { return _key.size () + _obj.size () + sizeof (*this); }
+    size_t size () const { return size (_key, _obj); }
+    // what an object for k and o would take, before it's set
+    static size_t size (const dsdc_key_t &k, const dsdc_obj_t &o)
+    { return k.size () + o.size () + sizeof (dsdc_cache_obj_t); }
     void collect_statistics (bool del = true,
                              dsdc::action_code_t t = dsdc::AC_NONE);
     bool match_checksum (const dsdc_cksum_t &cksum) const;
@@ -42,8 +54,36 @@ struct dsdc_cache_obj_t {
     dsdc::annotation::base_t *_annotation;
     u_int _n_gets, _n_gets_in_epoch;
 
+    // with -Q only: the partition the object is in, and when it was
+    // last put or hit, to compare LRU heads across partitions
+    dsdcs_partition_t *_partition;
+    u_int64_t _touched;
+
     ihash_entry<dsdc_cache_obj_t> _hlnk;
     tailq_entry<dsdc_cache_obj_t> _qlnk;
+    tailq_entry<dsdc_cache_obj_t> _plnk;
+};
+
+//
+// A part of a slave's cache set aside for one annotation's objects
+// (dsdc -Q); the objects of all other annotations share a default
+// partition.  Other partitions can't evict a partition below its
+// _min bytes, and it can't grow past _max (0 for no limit).  Past
+// their guarantees, partitions share what's left in LRU order.  A PUT
+// that would need to go below some partition's guarantee to fit gets
+// DSDC_NOROOM, and drops any value it would have replaced.
+//
+struct dsdcs_partition_t {
+    dsdcs_partition_t (const str &n, size_t mn, size_t mx)
+        : _name (n), _min (mn), _max (mx), _bytes (0), _objs (0),
+          _evictions (0), _evicted_bytes (0) {}
+    void to_xdr (dsdc_partition_stats_t *out) const;
+
+    const str _name;            // as given to -Q, or "-" for the default
+    const size_t _min, _max;
+    size_t _bytes, _objs;
+    u_int64_t _evictions, _evicted_bytes;     // to make room for PUTs
+    tailq<dsdc_cache_obj_t, &dsdc_cache_obj_t::_plnk> _lru;
 };
 
 typedef enum { MASTER_STATUS_OK = 0,
@@ -137,14 +177,27 @@ public:
     virtual void get_xdr_repr (dsdcx_slave_t *x) ;
     virtual bool is_lock_server () const { return false; }
 
+    // subscribe to pushed ring changes once registered with a master
+    virtual void subscribe_to_master (ptr<aclnt> c, const str &who) {}
+
     str startup_msg () const ;
     virtual void startup_msg_v (strbuf *b) const {}
     void set_stats_mode (bool b);
 
+    // register in the named slave group, rather than the default one
+    void set_group (const str &g) { _group = g; }
+    const str &group () const { return _group; }
+
+    void output_metrics (dsdc::metrics::out_t *o);
+    void connection_closed () { _n_conns--; }
+
 protected:
 
     bool get_port ();
     void new_connection ();
+
+    // n ring keys, seeded by our host, port, and (unless -R) pid
+    void make_ring_keys (u_int n, dsdc_keyset_t *out) const;
     /**
      * return an aclnt for the master that's currently serving as the
      * master primary.
@@ -158,30 +211,49 @@ protected:
     int _lfd;
 
     int _opts;     // options for configuring this slave
+    str _group;    // our slave group; NULL for the default
     bool _stats_mode; // on if we should be collecting stats
     int  _stats_mode2;  // > 0 if stats2 is running currently
+
+    size_t _n_conns;            // p2p connections open now
+    u_int64_t _n_conns_total;   // ... and ever
 };
 
+//
+// Lock servers register nodes in a ring of their own, and the locks
+// are partitioned over them by key, the same way data is over the
+// data slaves.
+//
 class dsdcs_lockserver_t : public dsdc_slave_app_t,
             public dsdcl_mgr_t {
 public:
-    dsdcs_lockserver_t (int port, int o = 0) :
-            dsdc_slave_app_t (port, o) {}
+    dsdcs_lockserver_t (int port, int o = 0, u_int nnodes = 0) :
+            dsdc_slave_app_t (port, o), 
+            _n_nodes (nnodes ? nnodes : dsdc_lockserver_nnodes) {}
     virtual ~dsdcs_lockserver_t () {}
+    bool init ();
     void dispatch (svccb *sbp);
     void get_xdr_repr (dsdcx_slave_t *x) ;
     bool is_lock_server () const { return true; }
     str progname_xtra () const { return "_nlm"; }
+    void output_metrics (dsdc::metrics::out_t *o);
+private:
+    dsdc_keyset_t _keys;
+    const u_int _n_nodes;
 };
 
 class dsdc_lru_t {
 public:
-    dsdc_lru_t () : _slow_cursor (NULL) {}
+    // the cleaner and the stats sweep can walk at the same time, so
+    // they each get a cursor of their own.
+    typedef enum { WALK_CLEAN = 0, WALK_STATS = 1, N_WALKS = 2 } walk_t;
+
+    dsdc_lru_t () { for (int i = 0; i < N_WALKS; i++) _slow_cursor[i] = NULL; }
     
     // For a "slow walk" over the LRU, which can be interrupted by 
     // twaits{}'s, use this slow_next() feature.
-    void slow_reset ();
-    dsdc_cache_obj_t *slow_next ();
+    void slow_reset (walk_t w = WALK_CLEAN);
+    dsdc_cache_obj_t *slow_next (walk_t w = WALK_CLEAN);
 
     dsdc_cache_obj_t *first ();
     dsdc_cache_obj_t *next (dsdc_cache_obj_t *o);
@@ -189,16 +261,40 @@ public:
     void remove (dsdc_cache_obj_t *o);
     void insert_tail (dsdc_cache_obj_t *o);
 private:
-    dsdc_cache_obj_t *_slow_cursor;
+    dsdc_cache_obj_t *_slow_cursor[N_WALKS];
     tailq<dsdc_cache_obj_t, &dsdc_cache_obj_t::_qlnk> _lru;
 };
 
+// what a data slave counts for the metrics page
+struct dsdcs_counters_t {
+    dsdcs_counters_t () { bzero (this, sizeof (*this)); }
+    u_int64_t _hits, _misses, _expired;
+    u_int64_t _removed[dsdc::AC_NOT_FOUND + 1];   // by action_code_t
+    u_int64_t _clean_passes;
+    u_int64_t _clean_usec;          // summed over all passes
+    u_int64_t _clean_last_usec;
+    u_int64_t _clean_last_objs;     // removed by the last pass
+};
+
+// a fill lease handed out by DSDC_LEASE_GET
+struct dsdcs_fill_lease_t {
+    dsdcs_fill_lease_t (const dsdc_key_t &k, dsdcl_id_t i, time_t e)
+        : _key (k), _id (i), _expires (e), _has_stale (false) {}
+    dsdc_key_t _key;
+    dsdcl_id_t _id;
+    time_t _expires;
+    bool _has_stale;
+    dsdc_obj_t _stale;       // what expired, for the clients who wait
+    ihash_entry<dsdcs_fill_lease_t> _hlnk;
+    tailq_entry<dsdcs_fill_lease_t> _qlnk;
+};
+
 class dsdc_slave_t : public dsdc_slave_app_t ,
             public dsdc_system_state_cache_t {
 public:
     dsdc_slave_t (u_int nnodes = 0, size_t maxsz = 0,
                   int port = dsdc_slave_port, int opts = 0);
-    virtual ~dsdc_slave_t () {}
+    virtual ~dsdc_slave_t ();
 
     void startup_msg_v (strbuf *b) const;
     bool init ();
@@ -206,6 +302,8 @@ public:
     void get_keys (dsdc_keyset_t *k) const { *k = _keys; }
     void get_xdr_repr (dsdcx_slave_t *x) ;
     bool clean_on_all_masters_dead () const { return false; }
+    void subscribe_to_master (ptr<aclnt> c, const str &who)
+    { subscribe (c, who); }
 
     void dispatch (svccb *sbp);
     void handle_get (svccb *sbp);
@@ -214,13 +312,20 @@ public:
     void handle_put3 (svccb *sbp);
     void handle_put4 (svccb *sbp);
     void handle_remove (svccb *sbp);
-    void handle_get_stats (svccb *sbp);
+    void handle_lock_get (svccb *sbp);
+    void handle_put_release (svccb *sbp);
+    void handle_lease_get (svccb *sbp, bool faulted = false);
+    void handle_lease_put (svccb *sbp);
+    void handle_get_stats (svccb *sbp) { handle_get_stats_T (sbp); }
     void handle_set_stats_mode (svccb *sbp);
+    void handle_get_mrc (svccb *sbp);
+    void handle_get_hot_keys (svccb *sbp);
 
     // Match function addition.
     void handle_compute_matches (svccb *sbp);
 
     str progname_xtra () const { return "_slave"; }
+    void output_metrics (dsdc::metrics::out_t *o);
 
     // implement virtual functions from the
     // dsdc_system_state_cache class
@@ -228,33 +333,69 @@ public:
     ptr<aclnt_wrap_t> new_lockserver_wrap (const str &h, int p) { return NULL; }
     ptr<aclnt> get_primary () { return dsdc_slave_app_t::get_primary (); }
     void set_stats_mode2 (int i);
+
+    // set aside min to max bytes (max 0 for no limit) for objects
+    // whose annotation::key () is k; false if k already has some
+    bool add_partition (const str &k, const str &name, size_t min,
+                        size_t max);
+
+    // spill objects evicted to make room into up to maxsz bytes
+    // under root (dsdc -k), and fault them back in on GETs
+    void add_ssd_tier (const str &root, size_t maxsz);
 protected:
     void run_stats2_loop (CLOSURE);
 
     dsdc_res_t handle_put (const dsdc_key_t &k, const dsdc_obj_t &o,
                            dsdc::annotation::base_t *a = NULL,
-                           const dsdc_cksum_t *cksum = NULL);
+                           const dsdc_cksum_t *cksum = NULL,
+                           dsdcs_partition_t *p = NULL);
     void genkeys ();
 
     dsdc_obj_t * lru_lookup (const dsdc_key_t &k, const int expire=-1,
                              dsdc::annotation::base_t *a  = NULL,
-                             bool* expired = NULL);
+                             bool* expired = NULL,
+                             dsdc_obj_t *stale = NULL,
+                             u_int grace = 0, bool *in_grace = NULL);
 
     size_t lru_remove_obj (dsdc_cache_obj_t *o, bool del,
                            dsdc::action_code_t t);
     bool lru_remove (const dsdc_key_t &k);
+    // fault_in for an object back from the disk tier, which isn't
+    // captured or counted as a PUT
     dsdc_res_t lru_insert (const dsdc_key_t &k, const dsdc_obj_t &o,
                            dsdc::annotation::base_t *a = NULL,
-                           const dsdc_cksum_t *cks = NULL);
+                           const dsdc_cksum_t *cks = NULL,
+                           dsdcs_partition_t *p = NULL,
+                           bool fault_in = false);
     size_t _lrusz;
 
+    // partitions (-Q); with none, the cache is one LRU.  partition ()
+    // is NULL if there are none.
+    dsdcs_partition_t *partition (const dsdc_annotation_t &a);
+    dsdc_cache_obj_t *make_room_victim (dsdcs_partition_t *p, size_t sz);
+    bool room_for (dsdcs_partition_t *p, size_t sz) const;
+    qhash<str, dsdcs_partition_t *> _partitions;
+    vec<dsdcs_partition_t *> _partition_list;
+    dsdcs_partition_t *_default_partition;
+    u_int64_t _lru_clock;
+
     void clean_cache () { clean_cache_T (); }
 
+    // whether k is ours under the current ring
+    bool owns (const dsdc_key_t &k);
+
+    void lock_get_granted (svccb *sbp, ptr<dsdc::rpcstats::timer_t> t,
+                           dsdcl_id_t id);
+
+    // leases for DSDC_LOCK_GET/DSDC_PUT_RELEASE, keyed by data key
+    dsdcl_mgr_t _leases;
+
     dsdc_keyset_t _keys;
     const u_int _n_nodes;
     const size_t _maxsz;
     bool _cleaning;
     bool _dirty;
+    bool _stats_sweeping;
 
 
     ihash<dsdc_key_t, dsdc_cache_obj_t, &dsdc_cache_obj_t::_key,
@@ -265,8 +406,37 @@ protected:
 
     dsdc_lru_t _lru;
 
+    // fill leases for DSDC_LEASE_GET/DSDC_LEASE_PUT.  They all have the
+    // same timeout, so the queue is in order of expiration.
+    dsdcs_fill_lease_t *fill_lease (const dsdc_key_t &k);
+    dsdcs_fill_lease_t *new_fill_lease (const dsdc_key_t &k);
+    void void_fill_lease (const dsdc_key_t &k);
+    void remove_fill_lease (dsdcs_fill_lease_t *l);
+
+    ihash<dsdc_key_t, dsdcs_fill_lease_t, &dsdcs_fill_lease_t::_key,
+    &dsdcs_fill_lease_t::_hlnk,
+    dsdck_hashfn_t, dsdck_equals_t> _fill_leases;
+    tailq<dsdcs_fill_lease_t, &dsdcs_fill_lease_t::_qlnk> _fill_lease_q;
+    dsdcl_id_t _next_fill_lease;
+
+    dsdcs_counters_t _counters;
+    dsdc::mrc::estimator_t _mrc;
+    dsdc::hotkey::tracker_t _hot_keys;
+
+    // the disk tier (-k); NULL if there isn't one
+    dsdc::ssd::tier_t *_ssd;
+
 private:
+    void reply_get (svccb *sbp, const dsdc_obj_t *o, bool expired,
+                    ptr<dsdc::trace::span_t> span);
+    void ssd_fault_in (dsdc_key_t k, int expire, u_int grace, evb_t ev,
+                       CLOSURE);
+    void ssd_get (svccb *sbp, dsdc_key_t k, int expire,
+                  ptr<dsdc::trace::span_t> span, CLOSURE);
+    void ssd_lease_get (svccb *sbp, dsdc_key_t k, int expire, u_int grace,
+                        CLOSURE);
     void clean_cache_T (CLOSURE);
+    void handle_get_stats_T (svccb *sbp, CLOSURE);
 
 };
 
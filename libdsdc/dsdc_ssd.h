@@ -0,0 +1,126 @@
+// -*-c++-*-
+/* $Id$ */
+
+#ifndef _DSDC_SSD_H_
+#define _DSDC_SSD_H_
+
+#include "async.h"
+#include "tame.h"
+#include "ihash.h"
+#include "list.h"
+#include "dsdc_prot.h"
+#include "dsdc_util.h"
+#include "dsdc_metrics.h"
+#include "fscache.h"
+
+//
+// A second tier for a data slave's cache, on local disk (dsdc -k).
+// Objects the memory LRU evicts to make room are written out through
+// an fscache engine, and a GET that misses in memory reads them back.
+// A key lives in at most one tier: reading it back, PUTting it, or
+// removing it drops the disk copy.
+//
+// The index of what's on disk is in memory only, at about 100 bytes a
+// key plus its annotation; copies on disk don't survive a restart.  Each spill goes to a
+// file of its own, named for the key and a generation number, so a
+// write still in flight never clobbers a newer copy, and a copy that
+// was dropped while being written is removed once the write is done.
+// The tier holds at most maxsz bytes of objects, and drops its oldest
+// copies to make room.
+//
+// Counts, the miss ratio curve and captures are for memory only: a
+// GET the disk serves is a miss there, and shows up here, and reading
+// a copy back isn't a PUT.  A LEASE_GET or GET_STALE reads the copy
+// back before it looks in memory, so expiry, grace and fill leases
+// work on it as on any other object; copies past expiry and grace
+// are dropped unread into memory.  A copy read back keeps the
+// annotation, and so the partition, it had when it was spilled.
+//
+
+namespace dsdc {
+    namespace ssd {
+
+        //--------------------------------------------------------
+
+        class tier_t {
+        public:
+            tier_t (const str &root, size_t maxsz);
+            ~tier_t ();
+
+            // nothing goes to disk until the engine is up
+            void init (CLOSURE);
+
+            // o, annotated with a, was evicted to make room; write it
+            // out, if there's room in the queue of writes
+            void spill (const dsdc_key_t &k, const dsdc_obj_t &o,
+                        time_t timein, const dsdc_annotation_t &a);
+
+            // whether there's a copy of k to fault in
+            bool has (const dsdc_key_t &k);
+
+            // read k's copy, when it went into the cache, and its
+            // annotation; NULL if it's gone or can't be read.  The copy
+            // stays until invalidate ().
+            typedef event<ptr<dsdc_obj_t>, time_t,
+                          dsdc_annotation_t>::ref fault_ev_t;
+            void fault (dsdc_key_t k, fault_ev_t ev, CLOSURE);
+
+            // drop k's copy; false if there wasn't one
+            bool invalidate (const dsdc_key_t &k);
+
+            // drop the copies of all keys keep () says no to; returns
+            // how many went
+            typedef callback<bool, const dsdc_key_t &>::ref keep_cb_t;
+            size_t clean (keep_cb_t keep);
+
+            str root () const { return _cfg._root; }
+            size_t maxsz () const { return _maxsz; }
+            void output_metrics (metrics::out_t *o) const;
+
+        private:
+            struct entry_t {
+                entry_t (const dsdc_key_t &k, u_int64_t g, size_t sz,
+                         time_t t, const dsdc_annotation_t &a)
+                    : _key (k), _gen (g), _size (sz), _timein (t),
+                      _annotation (a) {}
+                dsdc_key_t _key;
+                u_int64_t _gen;
+                u_int32_t _size;
+                time_t _timein;
+                dsdc_annotation_t _annotation;
+                str _pending;       // the data, until it's written
+                ihash_entry<entry_t> _hlnk;
+                tailq_entry<entry_t> _qlnk;
+            };
+
+            fscache::file_id_t file_id (const dsdc_key_t &k,
+                                        u_int64_t gen) const;
+            void drop (entry_t *e);
+            void write (dsdc_key_t k, u_int64_t gen, str data, CLOSURE);
+            void unlink (dsdc_key_t k, u_int64_t gen, CLOSURE);
+
+            fscache::cfg_t _cfg;
+            fscache::engine_t *_engine;
+            size_t _metrics_h;      // the engine's, for metrics::
+            const size_t _maxsz;
+            bool _ready;
+            ptr<bool> _alive;
+
+            ihash<dsdc_key_t, entry_t, &entry_t::_key, &entry_t::_hlnk,
+                  dsdck_hashfn_t, dsdck_equals_t> _index;
+            tailq<entry_t, &entry_t::_qlnk> _lru;   // oldest spill first
+            size_t _bytes;
+            u_int64_t _next_gen;
+            u_int _n_pending;
+
+            u_int64_t _spills, _skipped, _write_errors;
+            u_int64_t _fault_hits, _fault_misses;
+            u_int64_t _invalidated, _evictions;
+        };
+
+        //--------------------------------------------------------
+
+    };
+};
+
+#endif /* _DSDC_SSD_H_ */
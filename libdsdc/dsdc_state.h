@@ -8,6 +8,32 @@
 #include "dsdc_ring.h"
 #include "arpc.h"
 #include "tame.h"
+#include "ihash.h"
+
+/**
+ * the ring nodes that a single slave contributed to the hash ring; kept
+ * around so that one slave can be pulled out of the ring without
+ * rebuilding the whole thing.
+ */
+struct dsdc_ring_slave_t {
+    dsdc_ring_slave_t (const str &i, dsdc_hash_ring_t *r) 
+        : _id (i), _ring (r) {}
+    str _id;
+    dsdc_hash_ring_t *_ring;          // the ring of the slave's group
+    vec<dsdc_ring_node_t *> _nodes;
+    ihash_entry<dsdc_ring_slave_t> _hlnk;
+};
+
+/**
+ * the ring of a named slave group; the default group's ring is
+ * dsdc_system_state_cache_t::_hash_ring.
+ */
+struct dsdc_ring_group_t {
+    dsdc_ring_group_t (const str &n) : _name (n) {}
+    str _name;
+    dsdc_hash_ring_t _ring;
+    ihash_entry<dsdc_ring_group_t> _hlnk;
+};
 
 /**
  * a class that caches the global state of the system; included is
@@ -21,31 +47,76 @@ protected:
     virtual ~dsdc_system_state_cache_t ();
 
     void construct_tree ();
+    void insert_ring_slave (const dsdcx_slave_t &sl, const str &group = NULL);
+    bool remove_ring_slave (const str &h, int p);
+    void clear_ring ();
+
+    // the ring of a slave group (NULL or "" for the default group),
+    // or NULL if we know of no such group
+    const dsdc_hash_ring_t *ring (const str &group) const;
+    dsdc_ring_node_t *successor (const str &group, const dsdc_key_t &k) const;
     virtual void clean_cache () {}
     virtual ptr<aclnt> get_primary () = 0;
     virtual ptr<aclnt_wrap_t> new_wrap (const str &h, int p) = 0;
     virtual ptr<aclnt_wrap_t> new_lockserver_wrap (const str &h, int p) = 0;
 
+    // called when a slave leaves the ring by way of an incremental update;
+    // the full rebuild path uses pre_construct/post_construct instead.
+    virtual void release_wrap (const str &h, int p) {}
+
     virtual void pre_construct () {}
     virtual void post_construct () {}
     virtual bool clean_on_all_masters_dead () const = 0;
 
     void handle_refresh (const dsdc_getstate_res_t &r);
+    void handle_refresh2 (const dsdc_getstate2_res_t &r);
+    void rebuild_state ();
+    void apply_delta (const dsdcx_state_delta_t &d);
     void refresh (evv_t::ptr ev = NULL, CLOSURE);
     void refresh_loop (bool try_first, CLOSURE);
 
-    void refresh_lock_server ();
-    void change_lock_server_to (aclnt_wrap_t *nl);
+    // push notification of ring changes from the master; the poll in
+    // refresh_loop stays on as a backstop.
+    void subscribe (ptr<aclnt> c, const str &who, CLOSURE);
+    void handle_state_changed (svccb *sbp);
+    void refresh_on_push (CLOSURE);
+
+    // rebuild the lock ring from _lock_servers_xdr
+    void refresh_lock_servers ();
+
+    // the lock server that owns k, or NULL if there are none
+    ptr<aclnt_wrap_t> lock_server (const dsdc_key_t &k);
+
+    // the lock server with the given peer ID (host:port), even if
+    // it's no longer in the lock ring; NULL if the ID doesn't parse
+    ptr<aclnt_wrap_t> lock_server_by_id (const str &id);
+
     str fingerprint (str *in) const;
     void clear_all ();
 
     dsdcx_state_t  _system_state;
     dsdc_key_t _system_state_hash;
+    u_int64_t _system_state_incarnation;   // which master run we synced with
+    u_int64_t _system_state_epoch;         // 0 if never synced via GETSTATE2
+    bool _use_getstate2;                   // off if master is too old for it
     u_int _n_updates_since_clean;
     dsdc_hash_ring_t _hash_ring;
+    ihash<str, dsdc_ring_slave_t, &dsdc_ring_slave_t::_id,
+          &dsdc_ring_slave_t::_hlnk> _ring_slaves;
+    ihash<str, dsdc_ring_group_t, &dsdc_ring_group_t::_name,
+          &dsdc_ring_group_t::_hlnk> _ring_groups;
     ptr<bool> _destroyed;
-    aclnt_wrap_t *_lock_server;
+
+    // locks are partitioned over the lock servers by key; lock servers
+    // that register no nodes can only be reached as _lock_server, the
+    // first one the master knows about.
+    rpc_vec<dsdcx_slave_t, RPC_INFINITY> _lock_servers_xdr;
+    dsdc_hash_ring_t _lock_ring;
+    vec<ptr<aclnt_wrap_t> > _lock_wraps;
+    ptr<aclnt_wrap_t> _lock_server;
     bool _loop_running;
+    bool _push_refreshing;   // a pushed refresh is in flight
+    bool _push_pending;      // ... and another push came in meanwhile
 };
 
 
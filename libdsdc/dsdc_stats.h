@@ -18,6 +18,7 @@
 #include "arpc.h"
 #include "qhash.h"
 #include "ihash.h"
+#include "dsdc_rpcstats.h"
 
 namespace dsdc {
 
@@ -62,8 +63,17 @@ namespace dsdc {
             output (dsdc_statistic_t *out, const dsdc_dataset_params_t &p)
             { return false; }
 
+            // the same, plus sketches
+            virtual bool
+            output2 (dsdc_statistic2_t *out, const dsdc_dataset_params_t &p)
+            { return false; }
+
             list_entry<base_t> _llnk;
         };
+
+        // a short string for a, the same for equal annotations, such
+        // as "i:5" or "s:foo"
+        str key (const dsdc_annotation_t &a);
     };
 
     namespace stats {
@@ -79,6 +89,10 @@ namespace dsdc {
             output (dsdc_statistics_t *sz,
                     const dsdc_dataset_params_t &p) = 0;
 
+            virtual dsdc_res_t
+            output2 (dsdc_statistics2_t *sz, const dsdc_dataset_params_t &p)
+            { return DSDC_BAD_STATS; }
+
             virtual obj_t *
             alloc (const dsdc_annotation_t &a, bool newobj = true) = 0;
 
@@ -120,6 +134,50 @@ namespace dsdc {
 
         collector_base_t *collector ();
         void set_collector (collector_base_t *b);
+
+        //-----------------------------------------------------------
+
+        //
+        // A histogram that can be added up across slaves, with the
+        // same log-linear buckets as the RPC latency histograms.
+        // Buckets are only allocated as high as the biggest value
+        // seen so far.
+        //
+        class sketch_t {
+        public:
+            sketch_t () { clear (); }
+            void insert (u_int64_t v, u_int64_t n = 1);
+            void merge (const dsdc_sketch_t &in);
+            void clear ();
+            void to_xdr (dsdc_sketch_t *out) const;
+
+            // the value below which a fraction p of s's samples fell,
+            // to within the sketch's precision.
+            static u_int64_t quantile (const dsdc_sketch_t &s, double p);
+        private:
+            vec<u_int64_t> _buckets;
+            u_int64_t _n, _sum, _min, _max;
+        };
+
+        //-----------------------------------------------------------
+
+        //
+        // Adds up the statistics from several slaves, annotation by
+        // annotation.  Counters and sketches add up exactly; the old
+        // fixed-bucket histograms keep their sample counts, totals
+        // and extremes, but lose their buckets.
+        //
+        class merger_t {
+        public:
+            merger_t () {}
+            void add (const dsdc_statistics2_t &in);
+            void output (dsdc_statistics2_t *out) const { *out = _out; }
+        private:
+            qhash<str, size_t> _index;   // annotation -> slot in _out
+            dsdc_statistics2_t _out;
+        };
+
+        //-----------------------------------------------------------
     };
 
 //
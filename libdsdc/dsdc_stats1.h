@@ -27,10 +27,13 @@ namespace dsdc {
             void add (int e);
             void reset ();
             void to_xdr (dsdc_histogram_t *out, size_t nbuc);
+            void sketch_to_xdr (dsdc_sketch_t *out) const
+            { _sketch.to_xdr (out); }
             int scale_factor () const { return _scale_factor; }
             int _scale_factor;
             vec<int> _data_points;
             int _min, _max;
+            sketch_t _sketch;      // the same points, unscaled
         };
 
         //-----------------------------------------------------------------------
@@ -45,8 +48,14 @@ namespace dsdc {
 
             histogram_t _gets, *_lifetime, _objsz;
 
-            void prepare_sweep () { if (_n_active) *_n_active = 0; }
+            // a sweep refills the histograms over live objects
+            void prepare_sweep ()
+            { _gets.reset (); if (_lifetime) _lifetime->reset (); }
+
+            // live objects are counted as they come and go, not swept
             void inc_n_active () { if (_n_active) (*_n_active) ++; }
+            void dec_n_active ()
+            { if (_n_active && *_n_active > 0) (*_n_active) --; }
             void n_gets (int g);
 
             // do = "deleted object"
@@ -59,6 +68,7 @@ namespace dsdc {
             int *_n_active;
 
             bool output (dsdc_dataset_t *out, const dsdc_dataset_params_t &p);
+            void sketches (dsdc_dataset_sketches_t *out) const;
 
             time_t _start_time;
 
@@ -83,12 +93,15 @@ namespace dsdc {
             void mark_get_attempt (action_code_t t) {}
 
             bool output (dsdc_statistic_t *out, const dsdc_dataset_params_t &p);
+            bool output2 (dsdc_statistic2_t *out,
+                          const dsdc_dataset_params_t &p);
 
             void elem_create (size_t n)
             {
                 _alltime._creations ++ ;
                 _per_epoch._creations ++;
                 objsz (n);
+                inc_n_active ();
             }
 
             void prepare_sweep ()
@@ -107,6 +120,8 @@ namespace dsdc {
 
             void inc_n_active ()
             { _alltime.inc_n_active (); _per_epoch.inc_n_active (); }
+            void dec_n_active ()
+            { _alltime.dec_n_active (); _per_epoch.dec_n_active (); }
 
             void dead_object_n_gets (int n)
             { _alltime._do_gets.add (n); _per_epoch._do_gets.add (n); }
@@ -210,6 +225,8 @@ namespace dsdc {
 
             dsdc_res_t output (dsdc_statistics_t *sz,
                                const dsdc_dataset_params_t &p);
+            dsdc_res_t output2 (dsdc_statistics2_t *sz,
+                                const dsdc_dataset_params_t &p);
             u_int _n_stats;
 #ifndef DSDC_NO_CUPID
             annotation::frobber_t *frobber_alloc (ok_frobber_t f);
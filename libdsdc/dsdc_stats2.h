@@ -16,6 +16,7 @@ namespace dsdc {
             dist_v2_t ();
             void clear ();
             void insert (dsdc_statval_t v);
+            void remove (dsdc_statval_t v);
             void output_to_log (strbuf &b);
 
             dsdc_statval_t _min;
@@ -35,7 +36,11 @@ namespace dsdc {
             void output_to_log (strbuf &b);
 
             dist_v2_t  _dist_insert_sz;    // distribution of objs inserted
-            dist_v2_t  _dist_obj_sz;       // distribution of live objs
+
+            // distribution of live objs, kept up as they come and go,
+            // and not reset by clear ().  Its min and max are the
+            // extremes seen since the last time it was empty.
+            dist_v2_t  _dist_obj_sz;
 
             dsdc_statval_t  _n_get_hit;
             dsdc_statval_t  _n_get_notfound;
@@ -0,0 +1,88 @@
+// -*-c++-*-
+/* $Id$ */
+
+#ifndef _DSDC_TRACE_H_
+#define _DSDC_TRACE_H_
+
+#include "async.h"
+#include "dsdc_prot.h"
+
+//
+// Sampled request tracing.  A smart client starts a trace for a
+// fraction of its GETs (see set_sample_rate ()), and sends those as
+// DSDC_GET_TRACED.  Every process along the way that has a trace log
+// open appends its spans to it, one line per span:
+//
+//   <trace> <span> <parent> <kind> <start> <usec> <host>:<pid> <detail>
+//
+// IDs are in hex, and <start> is in microseconds since the epoch.
+// dsdc_admin -T reads the logs from any number of hosts and draws each
+// trace as a tree.  Time under a CALL span but outside the SERVE span
+// beneath it went to the wire and the server's socket queue.
+//
+// Hops that forward raw (-F) don't decode the request, so they log
+// nothing; the next hop's spans hang off the last hop that did.
+//
+
+namespace dsdc {
+    namespace trace {
+
+        //--------------------------------------------------------
+
+        typedef enum { SPAN_GET = 0,      // a smart client GET, end to end
+                       SPAN_CONNECT = 1,  // waiting for a connection
+                       SPAN_CALL = 2,     // an RPC, at the caller
+                       SPAN_SERVE = 3,    // handling a request
+                       SPAN_REPLY = 4,    // encoding and sending the reply
+                       N_KINDS = 5 } kind_t;
+
+        const char *kind_name (kind_t k);
+
+        //--------------------------------------------------------
+
+        // Log spans to path.  Lines are buffered and written out every
+        // dsdc_trace_flush_interval seconds; past dsdc_trace_max_bytes,
+        // the log moves to <path>.old and starts over.
+        bool open (const str &path);
+        void close ();
+        bool logging ();
+
+        // in a forked worker, e.g., dsdc -P -w: drop what the parent
+        // left unwritten, and log to <path>.<i>, under our own pid, so
+        // that workers don't roll each other's logs.
+        bool worker_reopen (int i);
+
+        // the fraction of GETs that start a trace here; 0 by default
+        void set_sample_rate (double r);
+        bool sample ();
+
+        // a context for a new trace, with no parent
+        void new_trace (dsdc_trace_ctx_t *out);
+
+        //--------------------------------------------------------
+
+        class span_t {
+        public:
+            span_t (const dsdc_trace_ctx_t &c, kind_t k);
+            ~span_t () { end (); }
+
+            // log the span, if it hasn't been already
+            void end (const str &detail = NULL);
+
+            // the context for calls made under this span
+            void child (dsdc_trace_ctx_t *out) const;
+        private:
+            const u_int64_t _trace;
+            const u_int64_t _parent;
+            const u_int64_t _id;
+            const kind_t _kind;
+            const timespec _start;
+            bool _done;
+        };
+
+        //--------------------------------------------------------
+
+    };
+};
+
+#endif /* _DSDC_TRACE_H_ */
@@ -42,6 +42,8 @@ public:
     { return dsdck_cmp (a,b) == 0; }
 };
 
+namespace dsdc { namespace metrics { class out_t; } }
+
 class dsdc_app_t {
 public:
     dsdc_app_t () : _daemonize (false) {}
@@ -54,6 +56,9 @@ public:
     virtual str progname_xtra () const { return NULL; }
     virtual void set_stats_mode (bool b) {}
     virtual void set_stats_mode2 (int i) {}
+
+    // this app's part of the metrics page; see dsdc_metrics.h
+    virtual void output_metrics (dsdc::metrics::out_t *o) {}
 private:
     bool _daemonize;
 
@@ -82,7 +87,53 @@ void set_debug (int lev);
 bool show_debug (int lev);
 str key_to_str (const dsdc_key_t &k);
 bool parse_hn (const str &in, str *host, int *port);
+str peer_id (const str &host, int port);
 
 bool is_empty_checksum (const dsdc_cksum_t &cksum);
 void make_empty_checksum (dsdc_cksum_t *out);
 
+//
+// The system state hash.  It's the SHA1 of the XOR of all per-slave
+// SHA1s, followed by the lock server's SHA1, so it doesn't depend on
+// slave order and the master can keep it up to date one slave at a
+// time.  Masters and clients both must use this to compare states.
+//
+class dsdc_state_hasher_t {
+public:
+    dsdc_state_hasher_t () { clear (); }
+    void clear ();
+
+    // XOR a slave's hash in or out; same operation either way
+    void toggle (const dsdc_key_t &slave_hash);
+    void finish (const dsdcx_slave_t *lock_server, dsdc_key_t *out) const;
+private:
+    dsdc_key_t _acc;
+};
+
+void dsdc_hash_slave (const dsdcx_slave_t &s, dsdc_key_t *out);
+void dsdc_hash_state (const dsdcx_state_t &s, dsdc_key_t *out);
+
+// what DSDC_GETSTATE sends: the default group and the lock server
+void dsdc_legacy_state (const dsdcx_state_t &s, dsdcx_legacy_state_t *out);
+
+// the hash DSDC_GETSTATE has always used: the SHA1 of the default
+// group and the lock server, in the order the master sent them
+void dsdc_legacy_hash_state (const dsdcx_state_t &s, dsdc_key_t *out);
+
+// for a slave in a named group; the same as the above for the default
+// group, so states without groups hash as they always have
+void dsdc_hash_slave (const dsdcx_slave_t &s, const str &group,
+                      dsdc_key_t *out);
+
+// the group called name in v, added at the end if it isn't there yet
+dsdcx_group_t *dsdc_find_group (rpc_vec<dsdcx_group_t, RPC_INFINITY> *v,
+                                const str &name);
+
+//
+// For replying with bytes that were XDR-encoded ahead of time (e.g.,
+// with xdr2str); pass a str* as the reply object:
+//
+//    sbp->reply (&s, dsdc_xdr_preencoded);
+//
+extern xdrproc_t dsdc_xdr_preencoded;
+
@@ -11,6 +11,7 @@
 #include "tame_nlock.h"
 #include "dsdc_const.h"
 #include "aiod2_client.h"
+#include "dsdc_metrics.h"
 
 namespace fscache {
 
@@ -173,6 +174,12 @@ namespace fscache {
         ptr<const backend_t> backend () const { return _backend; }
         const cfg_t *config () const { return _cfg; }
 
+        // for the metrics page: dsdc::metrics::add_source
+        //   (wrap (e, &engine_t::output_metrics)).  Counts calls to
+        // the backend, by whether they returned 0; a load of a file
+        // that isn't there is a failure.
+        virtual void output_metrics (dsdc::metrics::out_t *o);
+
     private:
         void load_T (file_id_t id, cbits_t cb, CLOSURE);
         void store_T (file_id_t id, time_t tm, str data, evi_t ev, CLOSURE);
@@ -184,6 +191,10 @@ namespace fscache {
         ptr<backend_t> _backend;         // the current backend
         vec<ptr<backend_t> > _backend_v; // all backends, including alternates
         ptr<bool> _alive;
+
+        enum { OP_LOAD = 0, OP_STORE = 1, OP_REMOVE = 2, N_OPS = 3 };
+        void count (int op, int rc) { (rc == 0 ? _ok : _failed)[op]++; }
+        u_int64_t _ok[N_OPS], _failed[N_OPS];
     };
 
     //-----------------------------------------------------------------------
@@ -240,6 +251,10 @@ namespace fscache {
         void get_stats (stats_t *stats) const;
         void reset_stats () { m_stats.reset(); }
 
+        // for the metrics page, after the base engine's; these
+        // counters start over on reset_stats ().
+        void output_metrics (dsdc::metrics::out_t *o);
+
         struct node_t {
             node_t (file_id_t fid, time_t t, str d, bool dirty);
             void store (engine_t *e, evv_t ev, CLOSURE);